@@ -0,0 +1,148 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#include "util/sharded_path.h"
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+/* Encrypted chunk storage in the flat layout (every chunk in one directory) against the sharded one (make_sharded_path).
+ * Chunks are stored like FileEncStorage does: written next to the storage, then renamed into place. Every layout is
+ * filled from scratch for every chunk count, which grows tenfold from 1000 up to the given maximum.
+ * Usage: bench-chunk-layout [max chunks] [chunk size] [lookups] */
+
+using namespace librevault;
+using bench_clock = std::chrono::steady_clock;
+using layout_fn = std::function<QString(const QString& root, const QByteArray& ct_hash)>;
+
+namespace {
+
+double elapsed_ms(bench_clock::time_point since) {
+	return std::chrono::duration<double, std::milli>(bench_clock::now() - since).count();
+}
+
+QByteArray random_hash(std::mt19937& rng) {
+	QByteArray ct_hash(28, 0);  // SHA3-224, as in ct_hash
+	for(char& c : ct_hash)
+		c = (char)rng();
+	return ct_hash;
+}
+
+QString flat_path(const QString& root, const QByteArray& ct_hash) {
+	return root + "/chunk-" + QString::fromStdString(crypto::Base32().to_string(ct_hash));
+}
+
+QString sharded_path(const QString& root, const QByteArray& ct_hash) {
+	return make_sharded_path(root, "chunk-", ct_hash);
+}
+
+void run_layout(const char* name, const layout_fn& make_path, const std::vector<QByteArray>& stored,
+                const std::vector<QByteArray>& missing, const QByteArray& content, int lookups, size_t& checksum) {
+	QTemporaryDir system_dir;
+	QString root = system_dir.path() + "/chunks";
+	QDir().mkpath(root);
+
+	auto put_started = bench_clock::now();
+	for(const QByteArray& ct_hash : stored) {
+		QFile chunk_f(system_dir.path() + "/incomplete-chunk");
+		chunk_f.open(QIODevice::WriteOnly | QIODevice::Truncate);
+		chunk_f.write(content);
+		chunk_f.close();
+
+		QString chunk_path = make_path(root, ct_hash);
+		QDir().mkpath(QFileInfo(chunk_path).path());
+		if(!chunk_f.rename(chunk_path))
+			std::fprintf(stderr, "could not store chunk: %s\n", qPrintable(chunk_f.errorString()));
+	}
+	double put_ms = elapsed_ms(put_started);
+
+	// Startup scan, like FileEncStorage::loadChunks
+	auto scan_started = bench_clock::now();
+	size_t scanned = 0;
+	QDirIterator it(root, {"chunk-*"}, QDir::Files, QDirIterator::Subdirectories);
+	while(it.hasNext()) {
+		it.next();
+		scanned++;
+	}
+	double scan_ms = elapsed_ms(scan_started);
+
+	std::mt19937 rng(7);
+	auto have_started = bench_clock::now();
+	for(int i = 0; i < lookups; i++) {
+		checksum += QFile::exists(make_path(root, stored[rng() % stored.size()]));
+		checksum += QFile::exists(make_path(root, missing[rng() % missing.size()]));
+	}
+	double have_ms = elapsed_ms(have_started);
+
+	auto get_started = bench_clock::now();
+	for(int i = 0; i < lookups; i++) {
+		QFile chunk_f(make_path(root, stored[rng() % stored.size()]));
+		if(chunk_f.open(QIODevice::ReadOnly))
+			checksum += chunk_f.readAll().size();
+	}
+	double get_ms = elapsed_ms(get_started);
+
+	std::printf("  %-8s put: %8.3f ms/chunk, scan: %10.2f ms (%zu files), have: %8.3f ms/lookup, get: %8.3f ms/chunk\n",
+		name, put_ms / stored.size(), scan_ms, scanned, have_ms / (2 * lookups), get_ms / lookups);
+}
+
+} /* namespace */
+
+int main(int argc, char** argv) {
+	const int max_chunks = argc > 1 ? std::atoi(argv[1]) : 100000;
+	const int chunk_size = argc > 2 ? std::atoi(argv[2]) : 4096;
+	const int lookups = argc > 3 ? std::atoi(argv[3]) : 10000;
+
+	std::mt19937 rng(42);
+	QByteArray content(chunk_size, 'x');
+
+	std::vector<QByteArray> missing;
+	for(int i = 0; i < 1000; i++)
+		missing.push_back(random_hash(rng));
+
+	size_t checksum = 0;
+	for(int chunk_count = 1000; chunk_count <= max_chunks; chunk_count *= 10) {
+		std::vector<QByteArray> stored;
+		for(int i = 0; i < chunk_count; i++)
+			stored.push_back(random_hash(rng));
+
+		std::printf("chunks: %d, chunk size: %d, lookups: %d\n", chunk_count, chunk_size, lookups);
+		run_layout("flat", flat_path, stored, missing, content, lookups, checksum);
+		run_layout("sharded", sharded_path, stored, missing, content, lookups, checksum);
+	}
+	std::printf("checksum: %zu\n", checksum);
+	return 0;
+}
@@ -0,0 +1,130 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#include "control/FolderParams.h"
+#include "control/StateCollector.h"
+#include "folder/meta/Index.h"
+#include <QCoreApplication>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <random>
+#include <vector>
+
+/* Index::getMeta(path_id) with and without meta_cache_. The index is filled once, then reopened with every cache size
+ * and read with a skewed access pattern: a small set of hot paths gets most of lookups, like a directory under active
+ * sync, while the rest are looked up rarely.
+ * Usage: bench-meta-cache [metas] [lookups] [cache size] */
+
+using namespace librevault;
+using bench_clock = std::chrono::steady_clock;
+
+namespace {
+
+double elapsed_ms(bench_clock::time_point since) {
+	return std::chrono::duration<double, std::milli>(bench_clock::now() - since).count();
+}
+
+QVariantMap make_fconfig(const Secret& secret, const QString& system_path, int meta_cache_size) {
+	QVariantMap fconfig;
+	fconfig["secret"] = QString::fromStdString(secret.string());
+	fconfig["path"] = system_path;
+	fconfig["system_path"] = system_path;
+	fconfig["db_wal"] = true;
+	fconfig["db_synchronous"] = "normal";
+	fconfig["meta_cache_size"] = meta_cache_size;
+	return fconfig;
+}
+
+} /* namespace */
+
+int main(int argc, char** argv) {
+	QCoreApplication app(argc, argv);
+
+	const int meta_count = argc > 1 ? std::atoi(argv[1]) : 20000;
+	const int lookups = argc > 2 ? std::atoi(argv[2]) : 100000;
+	const int cache_size = argc > 3 ? std::atoi(argv[3]) : 4096;
+
+	QTemporaryDir system_dir;
+	Secret secret;
+	StateCollector state_collector(nullptr);
+
+	std::vector<blob> path_ids;
+	double fill_ms;
+	{
+		FolderParams params(make_fconfig(secret, system_dir.path(), 0));
+		Index index(params, &state_collector, nullptr);
+
+		QList<SignedMeta> smetas;
+		for(int i = 0; i < meta_count; i++) {
+			Meta meta;
+			meta.set_path("dir-" + std::to_string(i), secret);
+			meta.set_meta_type(Meta::DIRECTORY);
+			meta.set_revision(std::time(nullptr));
+			smetas << SignedMeta(meta, secret);
+			path_ids.push_back(meta.path_id());
+		}
+
+		auto fill_started = bench_clock::now();
+		index.putMeta(smetas);
+		fill_ms = elapsed_ms(fill_started);
+	}
+
+	// Cubing a uniform value puts about half of lookups into the first 1/8 of paths
+	std::vector<int> pattern(lookups);
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	for(int& meta_idx : pattern)
+		meta_idx = std::min(meta_count - 1, int(std::pow(uniform(rng), 3) * meta_count));
+
+	std::printf("metas: %d, lookups: %d\n", meta_count, lookups);
+	std::printf("fill:     %10.2f ms\n", fill_ms);
+
+	size_t checksum = 0;
+	for(int meta_cache_size : {0, cache_size}) {
+		FolderParams params(make_fconfig(secret, system_dir.path(), meta_cache_size));
+		Index index(params, &state_collector, nullptr);
+
+		auto lookup_started = bench_clock::now();
+		for(int meta_idx : pattern)
+			checksum += index.getMeta(path_ids[meta_idx]).raw_meta().size();
+		double lookup_ms = elapsed_ms(lookup_started);
+
+		QJsonObject meta_cache = index.collect_state()["meta_cache"].toObject();
+		double hits = meta_cache["hits"].toDouble(), misses = meta_cache["misses"].toDouble();
+
+		std::printf("cache %5d entries: %8.4f ms/lookup, hit rate: %6.2f%%\n", meta_cache_size, lookup_ms / lookups,
+			hits + misses > 0 ? 100 * hits / (hits + misses) : 0);
+	}
+	std::printf("checksum: %zu\n", checksum);
+	return 0;
+}
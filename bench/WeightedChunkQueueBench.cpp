@@ -0,0 +1,124 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#include "folder/transfer/downloader/WeightedChunkQueue.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+/* Download queue under peer churn: every chunk is owned by a random subset of remotes, remotes connect and disconnect,
+ * and after every change the request pass walks the head of the queue.
+ * Usage: bench-weighted-chunk-queue [chunks] [remotes] [churn events] */
+
+using namespace librevault;
+using bench_clock = std::chrono::steady_clock;
+
+namespace {
+
+double elapsed_ms(bench_clock::time_point since) {
+	return std::chrono::duration<double, std::milli>(bench_clock::now() - since).count();
+}
+
+QByteArray chunk_name(int idx) {
+	return QByteArray((const char*)&idx, sizeof(idx));
+}
+
+} /* namespace */
+
+int main(int argc, char** argv) {
+	const int chunk_count = argc > 1 ? std::atoi(argv[1]) : 1000000;
+	const int remote_count = argc > 2 ? std::atoi(argv[2]) : 100;
+	const int churn_events = argc > 3 ? std::atoi(argv[3]) : 200;
+	const int visit_depth = 1000;     // Chunks, looked at by one request pass
+	const int chunks_per_remote = 8;  // Every remote owns about 1/8 of chunks
+
+	std::mt19937 rng(42);
+
+	// Ownership is fixed, connected remotes change
+	std::vector<std::vector<int>> remote_chunks(remote_count);
+	for(int chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++)
+		for(int remote_idx = 0; remote_idx < remote_count; remote_idx++)
+			if(rng() % chunks_per_remote == 0)
+				remote_chunks[remote_idx].push_back(chunk_idx);
+
+	std::vector<int> owned_by(chunk_count, 0);
+	std::vector<bool> connected(remote_count, false);
+	int connected_count = 0;
+
+	WeightedChunkQueue queue;
+
+	auto fill_started = bench_clock::now();
+	for(int chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++)
+		queue.addChunk(chunk_name(chunk_idx));
+	for(int chunk_idx = 0; chunk_idx < chunk_count; chunk_idx += 16)
+		queue.markClustered(chunk_name(chunk_idx));
+	double fill_ms = elapsed_ms(fill_started);
+
+	auto toggle_remote = [&](int remote_idx) {
+		connected[remote_idx] = !connected[remote_idx];
+		int delta = connected[remote_idx] ? 1 : -1;
+		connected_count += delta;
+
+		queue.setRemotesCount(connected_count);
+		for(int chunk_idx : remote_chunks[remote_idx]) {
+			owned_by[chunk_idx] += delta;
+			queue.setRemotesCount(chunk_name(chunk_idx), owned_by[chunk_idx]);
+		}
+	};
+
+	auto connect_started = bench_clock::now();
+	for(int remote_idx = 0; remote_idx < remote_count; remote_idx++)
+		toggle_remote(remote_idx);
+	double connect_ms = elapsed_ms(connect_started);
+
+	double churn_ms = 0, visit_ms = 0;
+	size_t visited = 0;
+	for(int event = 0; event < churn_events; event++) {
+		auto churn_started = bench_clock::now();
+		toggle_remote(rng() % remote_count);
+		churn_ms += elapsed_ms(churn_started);
+
+		auto visit_started = bench_clock::now();
+		int depth = 0;
+		queue.visit([&](const QByteArray& chunk) {
+			visited += chunk.size();    // Keeps the loop from being optimized out
+			return ++depth >= visit_depth;
+		});
+		visit_ms += elapsed_ms(visit_started);
+	}
+
+	std::printf("chunks: %d, remotes: %d, churn events: %d\n", chunk_count, remote_count, churn_events);
+	std::printf("fill:     %10.2f ms\n", fill_ms);
+	std::printf("connect:  %10.2f ms (all remotes)\n", connect_ms);
+	std::printf("churn:    %10.3f ms/event\n", churn_events ? churn_ms / churn_events : 0);
+	std::printf("visit:    %10.3f ms/pass (%d chunks)\n", churn_events ? visit_ms / churn_events : 0, visit_depth);
+	std::printf("checksum: %zu\n", visited);
+	return 0;
+}
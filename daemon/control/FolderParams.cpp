@@ -40,6 +40,8 @@ FolderParams::FolderParams(QVariantMap fconfig) {
 	// Optional
 	system_path = fconfig["system_path"].isValid() ? fconfig["system_path"].toString() : path + "/.librevault";
 	index_event_timeout = std::chrono::milliseconds(fconfig["index_event_timeout"].toInt());
+	index_commit_timeout = std::chrono::milliseconds(fconfig["index_commit_timeout"].toInt());
+	index_commit_batch = fconfig["index_commit_batch"].toUInt();
 	preserve_unix_attrib = fconfig["preserve_unix_attrib"].toBool();
 	preserve_windows_attrib = fconfig["preserve_windows_attrib"].toBool();
 	preserve_symlinks = fconfig["preserve_symlinks"].toBool();
@@ -65,6 +67,25 @@ FolderParams::FolderParams(QVariantMap fconfig) {
 	archive_trash_ttl = fconfig["archive_trash_ttl"].toInt();
 	archive_timestamp_count = fconfig["archive_timestamp_count"].toInt();
 	mainline_dht_enabled = fconfig["mainline_dht_enabled"].toBool();
+
+	QString enc_storage_str = fconfig["enc_storage"].toString();
+	if(enc_storage_str == "files")
+		enc_storage_type = EncStorageType::FILES;
+	if(enc_storage_str == "packed")
+		enc_storage_type = EncStorageType::PACKED;
+
+	enc_pack_segment_size = fconfig["enc_pack_segment_size"].toLongLong();
+	enc_pack_compact_ratio = fconfig["enc_pack_compact_ratio"].toDouble();
+	open_cache_memory_size = fconfig["open_cache_memory_size"].toLongLong();
+	open_cache_disk_size = fconfig["open_cache_disk_size"].toLongLong();
+
+	db_wal = fconfig["db_wal"].toBool();
+	db_synchronous = fconfig["db_synchronous"].toString();
+	db_mmap_size = fconfig["db_mmap_size"].toLongLong();
+	db_cache_size = fconfig["db_cache_size"].toLongLong();
+	db_temp_store_memory = fconfig["db_temp_store_memory"].toBool();
+	db_checkpoint_interval = std::chrono::seconds(fconfig["db_checkpoint_interval"].toInt());
+	meta_cache_size = fconfig["meta_cache_size"].toInt();
 }
 
 } /* namespace librevault */
@@ -44,6 +44,10 @@ struct FolderParams {
 		TIMESTAMP_ARCHIVE,
 		BLOCK_ARCHIVE
 	};
+	enum class EncStorageType : unsigned {
+		FILES = 0,
+		PACKED
+	};
 
 	FolderParams(QVariantMap fconfig);
 
@@ -52,6 +56,8 @@ struct FolderParams {
 	QString path;
 	QString system_path;
 	std::chrono::milliseconds index_event_timeout;
+	std::chrono::milliseconds index_commit_timeout;
+	unsigned index_commit_batch;
 	bool preserve_unix_attrib;
 	bool preserve_windows_attrib;
 	bool preserve_symlinks;
@@ -64,6 +70,20 @@ struct FolderParams {
 	unsigned archive_trash_ttl;
 	unsigned archive_timestamp_count;
 	bool mainline_dht_enabled;
+	EncStorageType enc_storage_type;
+	qint64 enc_pack_segment_size;
+	double enc_pack_compact_ratio;
+	qint64 open_cache_memory_size;
+	qint64 open_cache_disk_size;
+
+	/* Index database storage profile */
+	bool db_wal;
+	QString db_synchronous;
+	qint64 db_mmap_size;
+	qint64 db_cache_size;   // In KiB
+	bool db_temp_store_memory;
+	std::chrono::seconds db_checkpoint_interval;
+	int meta_cache_size;    // In entries
 };
 
 } /* namespace librevault */
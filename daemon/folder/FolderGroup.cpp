@@ -82,6 +82,7 @@ FolderGroup::FolderGroup(FolderParams params, StateCollector* state_collector, Q
 
 	// Connecting signals and slots
 	connect(meta_storage_, &MetaStorage::metaAdded, this, &FolderGroup::handle_indexed_meta);
+	connect(meta_storage_, &MetaStorage::onDiskChunksLost, this, &FolderGroup::handle_lost_chunks);
 	connect(chunk_storage_, &ChunkStorage::chunkAdded, this, [this](const blob& ct_hash){
 		downloader_->notifyLocalChunk(ct_hash);
 		uploader_->broadcast_chunk(remotes(), ct_hash);
@@ -116,6 +117,22 @@ void FolderGroup::handle_indexed_meta(const SignedMeta& smeta) {
 	meta_uploader_->broadcast_meta(remotes(), revision, bitfield);
 }
 
+void FolderGroup::handle_lost_chunks(const QList<QByteArray>& ct_hashes) {
+	// Metas, sharing these chunks, were dropped from the download queue and announced with them. Renotify with the actual bitfield
+	QSet<QByteArray> renotified_paths;
+	for(const QByteArray& ct_hash : ct_hashes) {
+		blob ct_hash_blob = conv_bytearray(ct_hash);
+		if(chunk_storage_->have_chunk(ct_hash_blob)) continue;
+
+		for(auto& smeta : meta_storage_->containingChunk(ct_hash_blob)) {
+			QByteArray path_id = conv_bytearray(smeta.meta().path_id());
+			if(renotified_paths.contains(path_id)) continue;
+			renotified_paths.insert(path_id);
+			handle_indexed_meta(smeta);
+		}
+	}
+}
+
 // RemoteFolder actions
 void FolderGroup::handle_handshake(RemoteFolder* origin) {
 	remotes_ready_.insert(origin);
@@ -201,6 +218,10 @@ void FolderGroup::push_state() {
 	state_collector_->folder_state_set(folderid(), "peers", peers_array);
 	// bandwidth
 	state_collector_->folder_state_set(folderid(), "traffic_stats", bandwidth_counter_.heartbeat_json());
+	// chunk caches
+	state_collector_->folder_state_set(folderid(), "chunk_storage", chunk_storage_->collect_state());
+	// meta caches
+	state_collector_->folder_state_set(folderid(), "meta_storage", meta_storage_->collect_state());
 }
 
 } /* namespace librevault */
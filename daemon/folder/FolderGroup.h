@@ -115,6 +115,7 @@ private:
 private slots:
 	void push_state();
 	void handle_indexed_meta(const SignedMeta& smeta);
+	void handle_lost_chunks(const QList<QByteArray>& ct_hashes);
 	void handle_handshake(RemoteFolder* origin);
 };
 
@@ -32,6 +32,7 @@
 #include <librevault/SignedMeta.h>
 #include <librevault/util/conv_bitfield.h>
 #include <QObject>
+#include <chrono>
 
 namespace librevault {
 
@@ -60,6 +61,9 @@ signals:
 	void rcvdBlockReply(blob, uint32_t, blob);
 	void rcvdBlockCancel(blob, uint32_t, uint32_t);
 
+	/* Some of the queued outgoing data is written to the network */
+	void bytesWritten();
+
 public:
 	RemoteFolder(QObject* parent);
 	virtual ~RemoteFolder();
@@ -82,7 +86,7 @@ public:
 	virtual void cancel_meta(const Meta::PathRevision& revision) = 0;
 
 	virtual void request_block(const blob& ct_hash, uint32_t offset, uint32_t size) = 0;
-	virtual void post_block(const blob& ct_hash, uint32_t offset, const blob& chunk) = 0;
+	virtual void post_block(const blob& ct_hash, uint32_t offset, blob block) = 0;
 	virtual void cancel_block(const blob& ct_hash, uint32_t offset, uint32_t size) = 0;
 
 	/* High-level RAII wrappers */
@@ -101,6 +105,8 @@ public:
 	bool peer_interested() const {return peer_interested_;}
 
 	virtual bool ready() const = 0;
+	virtual std::chrono::milliseconds rtt() const = 0;
+	virtual qint64 pendingBytes() const = 0;    // Queued for sending, but not yet written to the network
 
 protected:
 	bool am_choking_ = true;
@@ -28,6 +28,7 @@
  */
 #include "AssemblerQueue.h"
 #include "AssemblerWorker.h"
+#include "ChunkStorage.h"
 #include "folder/meta/MetaStorage.h"
 #include <QLoggingCategory>
 
@@ -47,32 +48,137 @@ AssemblerQueue::AssemblerQueue(const FolderParams& params,
 	path_normalizer_(path_normalizer),
 	archive_(archive) {
 
+	qRegisterMetaType<SignedMeta>("SignedMeta");
+
 	threadpool_ = new QThreadPool(this);
+	chunk_threadpool_ = new QThreadPool(this);
+
+	retry_timer_ = new QTimer(this);
+	retry_timer_->setSingleShot(true);
+	retry_timer_->setInterval(30*1000);
+	connect(retry_timer_, &QTimer::timeout, this, &AssemblerQueue::retryFailed);
 
 	assemble_timer_ = new QTimer(this);
-	assemble_timer_->setInterval(30*1000);
+	assemble_timer_->setInterval(10*60*1000);
+	assemble_timer_->setTimerType(Qt::VeryCoarseTimer);
 	connect(assemble_timer_, &QTimer::timeout, this, &AssemblerQueue::periodic_assemble_operation);
 	assemble_timer_->start();
+
+	QTimer::singleShot(0, this, &AssemblerQueue::periodic_assemble_operation);
 }
 
 AssemblerQueue::~AssemblerQueue() {
 	qCDebug(log_assembler) << "Stopping assembler queue";
 	emit aboutToStop();
 	threadpool_->waitForDone();
+	chunk_threadpool_->waitForDone();
 	qCDebug(log_assembler) << "Assembler queue stopped";
 }
 
 void AssemblerQueue::addAssemble(SignedMeta smeta) {
-	AssemblerWorker* worker = new AssemblerWorker(smeta, params_, meta_storage_, chunk_storage_, path_normalizer_, archive_);
+	QByteArray path_id = conv_bytearray(smeta.meta().path_id());
+	forgetWaiting(path_id);
+	failed_.remove(path_id);
+
+	WaitingMeta waiting{smeta, {}};
+	if(smeta.meta().meta_type() == Meta::FILE) {
+		bitfield_type bitfield = chunk_storage_->make_bitfield(smeta.meta());
+		for(size_t chunk_idx = 0; chunk_idx < bitfield.size(); chunk_idx++)
+			if(!bitfield[chunk_idx])
+				waiting.missing_chunks.insert(conv_bytearray(smeta.meta().chunks().at(chunk_idx).ct_hash));
+	}
+
+	if(waiting.missing_chunks.isEmpty()) {
+		startAssemble(smeta);
+	}else{
+		for(const QByteArray& ct_hash : waiting.missing_chunks)
+			chunk_waiters_[ct_hash].insert(path_id);
+		waiting_.insert(path_id, waiting);
+	}
+}
+
+void AssemblerQueue::notifyChunk(const blob& ct_hash) {
+	for(const QByteArray& path_id : chunk_waiters_.take(conv_bytearray(ct_hash))) {
+		auto waiting_it = waiting_.find(path_id);
+		if(waiting_it == waiting_.end()) continue;
+
+		waiting_it->missing_chunks.remove(conv_bytearray(ct_hash));
+		if(waiting_it->missing_chunks.isEmpty()) {
+			SignedMeta smeta = waiting_it->smeta;
+			waiting_.erase(waiting_it);
+			startAssemble(smeta);
+		}
+	}
+}
+
+void AssemblerQueue::forgetWaiting(const QByteArray& path_id) {
+	auto waiting_it = waiting_.find(path_id);
+	if(waiting_it == waiting_.end()) return;
+
+	for(const QByteArray& ct_hash : waiting_it->missing_chunks) {
+		auto waiters_it = chunk_waiters_.find(ct_hash);
+		if(waiters_it == chunk_waiters_.end()) continue;
+		waiters_it->remove(path_id);
+		if(waiters_it->isEmpty())
+			chunk_waiters_.erase(waiters_it);
+	}
+	waiting_.erase(waiting_it);
+}
+
+void AssemblerQueue::startAssemble(SignedMeta smeta) {
+	QByteArray path_id = conv_bytearray(smeta.meta().path_id());
+	if(running_.contains(path_id)) {
+		deferred_.insert(path_id, smeta);
+		return;
+	}
+	running_.insert(path_id);
+
+	AssemblerWorker* worker = new AssemblerWorker(smeta, params_, meta_storage_, chunk_storage_, path_normalizer_, archive_, chunk_threadpool_, this);
 	worker->setAutoDelete(true);
 	threadpool_->start(worker);
 }
 
+void AssemblerQueue::assembleFinished(SignedMeta smeta, bool assembled) {
+	QByteArray path_id = conv_bytearray(smeta.meta().path_id());
+	running_.remove(path_id);
+	if(deferred_.contains(path_id)) {
+		addAssemble(deferred_.take(path_id));
+		return;
+	}
+	if(assembled) return;
+
+	// A chunk could be reported, but not readable yet, or removed meanwhile. Then the meta waits for it again
+	bool all_present = true;
+	if(smeta.meta().meta_type() == Meta::FILE) {
+		bitfield_type bitfield = chunk_storage_->make_bitfield(smeta.meta());
+		for(size_t chunk_idx = 0; chunk_idx < bitfield.size(); chunk_idx++)
+			all_present = all_present && bitfield[chunk_idx];
+	}
+
+	if(all_present) {
+		failed_.insert(path_id, smeta);   // Not a missing chunk, so don't retry in a loop
+		if(!retry_timer_->isActive())
+			retry_timer_->start();
+	}else{
+		addAssemble(smeta);
+	}
+}
+
+void AssemblerQueue::retryFailed() {
+	QHash<QByteArray, SignedMeta> failed;
+	failed.swap(failed_);
+	for(auto& smeta : failed)
+		addAssemble(smeta);
+}
+
 void AssemblerQueue::periodic_assemble_operation() {
 	qCDebug(log_assembler) << "Performing periodic assemble";
 
-	for(auto smeta : meta_storage_->getIncompleteMeta())
-		addAssemble(smeta);
+	for(auto smeta : meta_storage_->getIncompleteMeta()) {
+		QByteArray path_id = conv_bytearray(smeta.meta().path_id());
+		if(!running_.contains(path_id))
+			addAssemble(smeta);
+	}
 }
 
 } /* namespace librevault */
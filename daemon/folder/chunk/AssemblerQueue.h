@@ -27,7 +27,10 @@
  * files in the program, then also delete it here.
  */
 #pragma once
+#include "blob.h"
 #include <librevault/SignedMeta.h>
+#include <QHash>
+#include <QSet>
 #include <QTimer>
 #include <QThreadPool>
 
@@ -59,6 +62,10 @@ public:
 
 public slots:
 	void addAssemble(SignedMeta smeta);
+	void notifyChunk(const blob& ct_hash);
+
+private slots:
+	void assembleFinished(SignedMeta smeta, bool assembled);
 
 private:
 	const FolderParams& params_;
@@ -68,7 +75,29 @@ private:
 	Archive* archive_;
 
 	QThreadPool* threadpool_;
+	QThreadPool* chunk_threadpool_;   // Shared by all AssemblerWorkers to read and decrypt chunks in parallel
+
+	/* Metas are assembled only when all their chunks are available. Until then they wait here with a set of missing chunks */
+	struct WaitingMeta {
+		SignedMeta smeta;
+		QSet<QByteArray> missing_chunks;
+	};
+	QHash<QByteArray, WaitingMeta> waiting_;              // path_id -> WaitingMeta
+	QHash<QByteArray, QSet<QByteArray>> chunk_waiters_;   // ct_hash -> path_ids, waiting for it
+
+	/* At most one worker per path is queued or running. A newer meta, that comes meanwhile, is assembled after it */
+	QSet<QByteArray> running_;                  // path_id
+	QHash<QByteArray, SignedMeta> deferred_;    // path_id -> SignedMeta
+
+	/* Failed metas are added again, so they wait for chunks, that are missing now. If none are, they are retried later */
+	QHash<QByteArray, SignedMeta> failed_;      // path_id -> SignedMeta
+	QTimer* retry_timer_;
+
+	void forgetWaiting(const QByteArray& path_id);
+	void retryFailed();
+	void startAssemble(SignedMeta smeta);
 
+	/* Safety net for chunks, that became available without notifyChunk() */
 	void periodic_assemble_operation();
 	QTimer* assemble_timer_;
 };
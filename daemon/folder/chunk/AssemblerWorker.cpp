@@ -34,12 +34,17 @@
 #include "folder/PathNormalizer.h"
 #include "folder/chunk/archive/Archive.h"
 #include "folder/meta/MetaStorage.h"
+#include "util/FutureRunnable.h"
 #include "util/conv_fspath.h"
+#include "util/file_copy_range.h"
+#include "util/file_pread.h"
 #include "util/readable.h"
+#include <librevault/crypto/HMAC-SHA3.h>
 #include <boost/filesystem.hpp>
 #include <QDir>
 #include <QLoggingCategory>
 #include <QSaveFile>
+#include <deque>
 #ifdef Q_OS_UNIX
 #   include <sys/stat.h>
 #endif
@@ -55,23 +60,28 @@ AssemblerWorker::AssemblerWorker(SignedMeta smeta, const FolderParams& params,
 	                             MetaStorage* meta_storage,
 	                             ChunkStorage* chunk_storage,
 	                             PathNormalizer* path_normalizer,
-	                             Archive* archive) :
+	                             Archive* archive,
+	                             QThreadPool* chunk_threadpool,
+	                             QObject* queue) :
 	params_(params),
 	meta_storage_(meta_storage),
 	chunk_storage_(chunk_storage),
 	path_normalizer_(path_normalizer),
 	archive_(archive),
+	chunk_threadpool_(chunk_threadpool),
+	queue_(queue),
 	smeta_(smeta),
 	meta_(smeta.meta()) {}
 
 AssemblerWorker::~AssemblerWorker() {}
 
-QByteArray AssemblerWorker::get_chunk_pt(const blob& ct_hash) const {
-	blob chunk = conv_bytearray(chunk_storage_->get_chunk(ct_hash));
+QByteArray AssemblerWorker::get_chunk_pt(const Meta::Chunk& chunk) const {
+	// Chunks are read once per assembly, so they would only push useful chunks out of the memory cache
+	blob chunk_ct = conv_bytearray(chunk_storage_->get_chunk(chunk.ct_hash, false));
 
 	try {
-		QPair<quint32, QByteArray> size_iv = meta_storage_->getChunkSizeIv(ct_hash);
-		blob chunk_pt_v = Meta::Chunk::decrypt(chunk, size_iv.first, params_.secret.get_Encryption_Key(), conv_bytearray(size_iv.second));
+		// Size and IV are taken from the meta, that is being assembled, so no index lookups are needed
+		blob chunk_pt_v = Meta::Chunk::decrypt(chunk_ct, chunk.size, params_.secret.get_Encryption_Key(), chunk.iv);
 		return conv_bytearray(chunk_pt_v);
 	}catch(std::exception& e){
 		qCWarning(log_assembler) << "Could not get plaintext chunk (which is marked as existing in index), DB collision";
@@ -85,8 +95,8 @@ void AssemblerWorker::run() noexcept {
 	normpath_ = QByteArray::fromStdString(meta_.path(params_.secret));
 	denormpath_ = path_normalizer_->denormalizePath(normpath_);
 
+	bool assembled = false;
 	try {
-		bool assembled = false;
 		switch(meta_.meta_type()) {
 			case Meta::FILE: assembled = assemble_file();
 				break;
@@ -111,6 +121,8 @@ void AssemblerWorker::run() noexcept {
 	}catch(std::exception& e) {
 		qCWarning(log_assembler) << "Unknown exception while assembling:" << meta_.path(params_.secret).c_str() << "E:" << e.what();    // FIXME: #83
 	}
+
+	QMetaObject::invokeMethod(queue_, "assembleFinished", Qt::QueuedConnection, Q_ARG(SignedMeta, smeta_), Q_ARG(bool, assembled));
 }
 
 bool AssemblerWorker::assemble_deleted() {
@@ -146,6 +158,26 @@ bool AssemblerWorker::assemble_directory() {
 	return true;    // Maybe, something else?
 }
 
+QHash<QByteArray, quint64> AssemblerWorker::get_reusable_chunks(QFile& old_f) const {
+	QHash<QByteArray, quint64> reusable_chunks;   // ct_hash -> offset in old_f
+
+	QList<MetaStorage::OnDiskChunk> ondisk_chunks = meta_storage_->onDiskChunks(meta_.path_id());
+	if(ondisk_chunks.isEmpty() || !old_f.open(QIODevice::ReadOnly))
+		return reusable_chunks;
+
+	// These are only candidates. The file could be changed in place after being assembled, so every range is verified before reuse.
+	for(auto& ondisk_chunk : ondisk_chunks)
+		reusable_chunks.insert(conv_bytearray(ondisk_chunk.ct_hash), ondisk_chunk.offset);
+	return reusable_chunks;
+}
+
+bool AssemblerWorker::verify_reusable_chunk(QFile& old_f, quint64 offset, const Meta::Chunk& chunk) const {
+	blob chunk_pt(chunk.size);
+	if(file_pread(old_f, reinterpret_cast<char*>(chunk_pt.data()), chunk.size, offset) != (qint64)chunk.size)
+		return false;
+	return (chunk_pt | crypto::HMAC_SHA3_224(params_.secret.get_Encryption_Key())) == chunk.pt_hmac;
+}
+
 bool AssemblerWorker::assemble_file() {
 	LOGFUNC();
 
@@ -156,16 +188,76 @@ bool AssemblerWorker::assemble_file() {
 	//
 	QString assembly_path = params_.system_path + "/" + conv_fspath(boost::filesystem::unique_path("assemble-%%%%-%%%%-%%%%-%%%%"));
 
-	// TODO: Check for assembled chunk and try to extract them and push into encstorage.
 	QSaveFile assembly_f(assembly_path); // Opening file
 	if(! assembly_f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
 		qCWarning(log_assembler) << "File cannot be opened:" << assembly_path << "E:" << assembly_f.errorString();  // FIXME: #83
 		throw abort_assembly();
 	}
 
-	for(auto chunk : meta_.chunks()) {
-		assembly_f.write(get_chunk_pt(chunk.ct_hash)); // Writing to file
+	// Chunks, that are unchanged since the revision, which is still on disk, are copied from there as plaintext
+	QFile old_f(denormpath_);
+	QHash<QByteArray, quint64> reusable_chunks = get_reusable_chunks(old_f);
+
+	// Other chunks are read and decrypted on chunk_threadpool_, while this thread writes earlier ones in file order.
+	// Reusable ranges are verified there too, and fall back to decryption, if the file has been changed.
+	// At most max_pending chunks are kept in memory at once.
+	struct PendingChunk {
+		std::future<QByteArray> chunk_pt;   // Null, if the range is copied from old_f
+		qint64 reuse_offset;    // Offset in old_f
+		quint32 size;
+	};
+	std::deque<PendingChunk> pending_chunks;
+	const size_t max_pending = std::max(chunk_threadpool_->maxThreadCount(), 1) * 2;
+
+	params_.secret.get_Encryption_Key();   // The key is derived lazily on first use. Do it before decryption jobs start.
+
+	qint64 write_offset = 0;
+	auto write_chunk = [&] {
+		PendingChunk pending_chunk = std::move(pending_chunks.front());
+		pending_chunks.pop_front();
+
+		bool written;
+		QByteArray chunk_pt = pending_chunk.chunk_pt.get();
+		if(!chunk_pt.isNull())
+			written = assembly_f.write(chunk_pt) == chunk_pt.size();
+		else
+			written = file_copy_range(old_f, pending_chunk.reuse_offset, assembly_f, write_offset, pending_chunk.size);
+
+		if(!written) {
+			qCWarning(log_assembler) << "File cannot be written:" << assembly_path << "E:" << assembly_f.errorString(); // FIXME: #83
+			throw abort_assembly();
+		}
+		write_offset += pending_chunk.size;
+	};
+
+	try {
+		for(const Meta::Chunk& chunk : meta_.chunks()) {
+			if(pending_chunks.size() >= max_pending)
+				write_chunk();
+
+			auto reusable_it = reusable_chunks.find(conv_bytearray(chunk.ct_hash));
+			if(reusable_it != reusable_chunks.end()) {
+				quint64 reuse_offset = reusable_it.value();
+				pending_chunks.push_back({run_future<QByteArray>(chunk_threadpool_, [this, chunk, &old_f, reuse_offset] {
+					if(verify_reusable_chunk(old_f, reuse_offset, chunk))
+						return QByteArray();
+					qCDebug(log_assembler) << "Chunk was changed on disk since it was assembled, decrypting:" << ct_hash_readable(chunk.ct_hash);
+					return get_chunk_pt(chunk);
+				}), (qint64)reuse_offset, chunk.size});
+			}else
+				pending_chunks.push_back({run_future<QByteArray>(chunk_threadpool_, [this, chunk] {
+					return get_chunk_pt(chunk);
+				}), -1, chunk.size});
+		}
+		while(!pending_chunks.empty())
+			write_chunk();
+	}catch(...){
+		// Decryption jobs call back into this worker, don't leave assemble_file() before they are done
+		for(auto& pending_chunk : pending_chunks)
+			pending_chunk.chunk_pt.wait();
+		throw;
 	}
+	old_f.close();
 
 	if(!assembly_f.commit()) {
 		qCWarning(log_assembler) << "File cannot be written:" << assembly_path << "E:" << assembly_f.errorString(); // FIXME: #83
@@ -29,8 +29,11 @@
 #pragma once
 #include "blob.h"
 #include <librevault/SignedMeta.h>
+#include <QFile>
+#include <QHash>
 #include <QObject>
 #include <QRunnable>
+#include <QThreadPool>
 
 namespace librevault {
 
@@ -53,7 +56,9 @@ public:
 					MetaStorage* meta_storage,
 					ChunkStorage* chunk_storage,
 					PathNormalizer* path_normalizer,
-					Archive* archive);
+					Archive* archive,
+					QThreadPool* chunk_threadpool,
+					QObject* queue);
 	virtual ~AssemblerWorker();
 
 	void run() noexcept override;
@@ -64,6 +69,8 @@ private:
 	ChunkStorage* chunk_storage_;
 	PathNormalizer* path_normalizer_;
 	Archive* archive_;
+	QThreadPool* chunk_threadpool_;
+	QObject* queue_;
 
 	SignedMeta smeta_;
 	const Meta& meta_;
@@ -78,7 +85,9 @@ private:
 
 	void apply_attrib();
 
-	QByteArray get_chunk_pt(const blob& ct_hash) const;
+	QByteArray get_chunk_pt(const Meta::Chunk& chunk) const;
+	QHash<QByteArray, quint64> get_reusable_chunks(QFile& old_f) const;
+	bool verify_reusable_chunk(QFile& old_f, quint64 offset, const Meta::Chunk& chunk) const;
 };
 
 } /* namespace librevault */
@@ -33,6 +33,7 @@
 #include "control/FolderParams.h"
 #include "folder/chunk/archive/Archive.h"
 #include "folder/meta/MetaStorage.h"
+#include "util/readable.h"
 
 #include "AssemblerQueue.h"
 
@@ -47,9 +48,8 @@ ChunkStorage::ChunkStorage(const FolderParams& params, MetaStorage* meta_storage
 		open_storage = new OpenStorage(params, meta_storage_, path_normalizer, this);
 		archive = new Archive(params, meta_storage_, path_normalizer, this);
 		file_assembler = new AssemblerQueue(params, meta_storage_,  this, path_normalizer, archive, this);
+		connect(meta_storage_, &MetaStorage::metaAddedExternal, file_assembler, &AssemblerQueue::addAssemble);
 	}
-
-	connect(meta_storage_, &MetaStorage::metaAddedExternal, file_assembler, &AssemblerQueue::addAssemble);
 };
 
 ChunkStorage::~ChunkStorage() {}
@@ -58,7 +58,7 @@ bool ChunkStorage::have_chunk(const blob& ct_hash) const noexcept {
 	return mem_storage->have_chunk(ct_hash) || enc_storage->have_chunk(ct_hash) || (open_storage && open_storage->have_chunk(ct_hash));
 }
 
-QByteArray ChunkStorage::get_chunk(const blob& ct_hash) {
+QByteArray ChunkStorage::get_chunk(const blob& ct_hash, bool populate_cache) {
 	try {
 		// Cache hit
 		return mem_storage->get_chunk(ct_hash);
@@ -73,15 +73,44 @@ QByteArray ChunkStorage::get_chunk(const blob& ct_hash) {
 			else
 				throw;
 		}
-		mem_storage->put_chunk(ct_hash, chunk); // Put into cache
+		if(populate_cache)
+			mem_storage->put_chunk(ct_hash, chunk); // Put into cache
 		return chunk;
 	}
 }
 
+blob ChunkStorage::get_block(const blob& ct_hash, uint32_t offset, uint32_t size) {
+	QByteArray chunk;
+	try {
+		chunk = mem_storage->get_chunk(ct_hash);
+	}catch(no_such_chunk& e) {
+		// Encrypted chunks are read partially, so a small block doesn't pull the whole chunk from disk
+		try {
+			return enc_storage->get_block(ct_hash, offset, size);
+		}catch(no_such_chunk& e) {}
+
+		// Open storage has to encrypt the whole chunk anyway, so it goes through the cache
+		chunk = get_chunk(ct_hash);
+	}
+
+	if((qint64)offset + size > chunk.size())
+		throw no_such_chunk();
+	return blob(chunk.begin()+offset, chunk.begin()+offset+size);
+}
+
 void ChunkStorage::put_chunk(QByteArray ct_hash, QFile* chunk_f) {
-	enc_storage->put_chunk(ct_hash, chunk_f);
-	for(auto& smeta : meta_storage_->containingChunk(conv_bytearray(ct_hash)))
-		file_assembler->addAssemble(smeta);
+	// Backends log and drop chunks, they could not store. Waiters are started only on chunks, that are actually there
+	try {
+		enc_storage->put_chunk(ct_hash, chunk_f);
+	}catch(std::exception& e) {
+		LOGW("Could not store encrypted block" << ct_hash_readable(ct_hash) << ":" << e.what());
+		return;
+	}
+	if(!enc_storage->have_chunk(conv_bytearray(ct_hash)))
+		return;
+
+	if(file_assembler)
+		file_assembler->notifyChunk(conv_bytearray(ct_hash));
 
 	emit chunkAdded(conv_bytearray(ct_hash));
 }
@@ -99,10 +128,26 @@ bitfield_type ChunkStorage::make_bitfield(const Meta& meta) const noexcept {
 		return bitfield_type();
 }
 
+bitfield_type ChunkStorage::make_bitfield(const std::vector<blob>& ct_hashes) const noexcept {
+	bitfield_type bitfield(ct_hashes.size());
+	for(size_t bitfield_idx = 0; bitfield_idx < ct_hashes.size(); bitfield_idx++)
+		if(have_chunk(ct_hashes[bitfield_idx]))
+			bitfield[bitfield_idx] = true;
+	return bitfield;
+}
+
 void ChunkStorage::cleanup(const Meta& meta) {
 	for(auto chunk : meta.chunks())
 		if(open_storage->have_chunk(chunk.ct_hash))
 			enc_storage->remove_chunk(chunk.ct_hash);
 }
 
+QJsonObject ChunkStorage::collect_state() {
+	QJsonObject state;
+	state["memory_cache"] = mem_storage->collect_state();
+	if(open_storage)
+		state["open_cache"] = open_storage->collect_state();
+	return state;
+}
+
 } /* namespace librevault */
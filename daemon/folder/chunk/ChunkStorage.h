@@ -28,9 +28,11 @@
  */
 #pragma once
 #include "blob.h"
+#include "util/log.h"
 #include <librevault/Meta.h>
 #include <librevault/util/conv_bitfield.h>
 #include <QFile>
+#include <QJsonObject>
 
 namespace librevault {
 
@@ -46,6 +48,7 @@ class AssemblerQueue;
 
 class ChunkStorage : public QObject {
 	Q_OBJECT
+	LOG_SCOPE("ChunkStorage");
 public:
 	struct no_such_chunk : public std::runtime_error {
 		no_such_chunk() : std::runtime_error("Requested Chunk not found"){}
@@ -55,13 +58,17 @@ public:
 	virtual ~ChunkStorage();
 
 	bool have_chunk(const blob& ct_hash) const noexcept ;
-	QByteArray get_chunk(const blob& ct_hash);  // Throws AbstractFolder::no_such_chunk
+	QByteArray get_chunk(const blob& ct_hash, bool populate_cache = true);  // Throws AbstractFolder::no_such_chunk
+	blob get_block(const blob& ct_hash, uint32_t offset, uint32_t size);    // Throws AbstractFolder::no_such_chunk, also if the range is out of chunk
 	void put_chunk(QByteArray ct_hash, QFile* chunk_f);
 
 	bitfield_type make_bitfield(const Meta& meta) const noexcept;   // Bulk version of "have_chunk"
+	bitfield_type make_bitfield(const std::vector<blob>& ct_hashes) const noexcept;
 
 	void cleanup(const Meta& meta);
 
+	QJsonObject collect_state();
+
 signals:
 	void chunkAdded(blob ct_hash);
 
@@ -70,9 +77,9 @@ protected:
 
 	MemoryCachedStorage* mem_storage;
 	EncStorage* enc_storage;
-	OpenStorage* open_storage;
-	Archive* archive;
-	AssemblerQueue* file_assembler;
+	OpenStorage* open_storage = nullptr;
+	Archive* archive = nullptr;
+	AssemblerQueue* file_assembler = nullptr;
 };
 
 } /* namespace librevault */
@@ -30,12 +30,24 @@
 #include "blob.h"
 #include "util/log.h"
 #include <QFile>
-#include <QReadWriteLock>
-#include <memory>
 
 namespace librevault {
 
 class FolderParams;
+
+struct EncStorageBackend : public QObject {
+	Q_OBJECT
+public:
+	virtual bool have_chunk(const blob& ct_hash) const noexcept = 0;
+	virtual QByteArray get_chunk(const blob& ct_hash) const = 0;   // Throws ChunkStorage::no_such_chunk
+	virtual blob get_block(const blob& ct_hash, uint32_t offset, uint32_t size) const = 0;  // Reads only the requested range
+	virtual void put_chunk(const QByteArray& ct_hash, QFile* chunk_f) = 0;
+	virtual void remove_chunk(const blob& ct_hash) = 0;
+
+protected:
+	EncStorageBackend(QObject* parent) : QObject(parent) {}
+};
+
 class EncStorage : public QObject {
 	Q_OBJECT
 	LOG_SCOPE("EncStorage");
@@ -44,16 +56,12 @@ public:
 
 	bool have_chunk(const blob& ct_hash) const noexcept;
 	QByteArray get_chunk(const blob& ct_hash) const;
+	blob get_block(const blob& ct_hash, uint32_t offset, uint32_t size) const;
 	void put_chunk(const QByteArray& ct_hash, QFile* chunk_f);
 	void remove_chunk(const blob& ct_hash);
 
 private:
-	const FolderParams& params_;
-	mutable QReadWriteLock storage_mtx_;
-
-	QString make_chunk_ct_name(QByteArray ct_hash) const noexcept;
-	QString make_chunk_ct_path(const blob& ct_hash) const noexcept;
-	QString make_chunk_ct_path(QByteArray ct_hash) const noexcept;
+	EncStorageBackend* backend_;
 };
 
 } /* namespace librevault */
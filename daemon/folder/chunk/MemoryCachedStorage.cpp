@@ -28,36 +28,166 @@
  */
 #include "MemoryCachedStorage.h"
 #include "ChunkStorage.h"
+#include "control/Config.h"
+#include "util/ct_hash_key.h"
+#include <algorithm>
 
 namespace librevault {
 
-MemoryCachedStorage::MemoryCachedStorage(QObject* parent) : QObject(parent), cache_(50*1024*1024) {}    // 50 MB cache is enough for most purposes
+/* ChunkCache */
+ChunkCache* ChunkCache::get_instance() {
+	static ChunkCache instance(Config::get()->getGlobal("chunk_cache_size").toLongLong());
+	return &instance;
+}
+
+ChunkCache::ChunkCache(qint64 capacity) :
+	capacity_(capacity),
+	shard_count_((unsigned)qBound(qint64(1), capacity / (2 * max_chunk_cost), qint64(max_shard_count))),
+	shard_capacity_(capacity / shard_count_),
+	shards_(new Shard[shard_count_]) {}
+
+bool ChunkCache::have_chunk(const blob& ct_hash) const noexcept {
+	quint64 key = ct_hash_key(ct_hash);
+	Shard& s = shard(key);
+	QMutexLocker lk(&s.lock);
+
+	auto it = s.entries.find(key);
+	return it != s.entries.end() && (*it)->ct_hash == conv_bytearray(ct_hash);
+}
+
+QByteArray ChunkCache::get_chunk(const blob& ct_hash) const {
+	quint64 key = ct_hash_key(ct_hash);
+	Shard& s = shard(key);
+	QMutexLocker lk(&s.lock);
+
+	auto it = s.entries.find(key);
+	if(it == s.entries.end() || (*it)->ct_hash != conv_bytearray(ct_hash))
+		return QByteArray();
+
+	EntryList::iterator entry_it = *it;
+	if(entry_it->in_main)
+		s.main_queue.splice(s.main_queue.begin(), s.main_queue, entry_it);
+	return entry_it->data;
+}
+
+void ChunkCache::put_chunk(const blob& ct_hash, QByteArray data, std::shared_ptr<Counters> owner) {
+	Entry entry{ct_hash_key(ct_hash), conv_bytearray(ct_hash), data, std::move(owner), false};
+	if(entry.cost() > shard_capacity_ / 2)
+		return;     // Would flush most of the shard
+
+	Shard& s = shard(entry.key);
+	QMutexLocker lk(&s.lock);
+
+	auto it = s.entries.find(entry.key);
+	if(it != s.entries.end()) {
+		entry.in_main = (*it)->in_main;
+		erase(s, *it);
+	}
+
+	auto ghost_it = s.ghost_index.find(entry.key);
+	if(ghost_it != s.ghost_index.end()) {
+		// Requested again soon after being pushed out of the FIFO queue, so it is hot
+		s.ghosts.erase(*ghost_it);
+		s.ghost_index.erase(ghost_it);
+		entry.in_main = true;
+	}
+
+	EntryList& queue = entry.in_main ? s.main_queue : s.in_queue;
+	(entry.in_main ? s.main_size : s.in_size) += entry.cost();
+	queue.push_front(std::move(entry));
+	s.entries.insert(queue.front().key, queue.begin());
+
+	evict(s);
+}
+
+void ChunkCache::remove_chunk(const blob& ct_hash) noexcept {
+	quint64 key = ct_hash_key(ct_hash);
+	Shard& s = shard(key);
+	QMutexLocker lk(&s.lock);
+
+	auto it = s.entries.find(key);
+	if(it != s.entries.end())
+		erase(s, *it);
+}
+
+qint64 ChunkCache::size() const {
+	qint64 total = 0;
+	for(unsigned shard_idx = 0; shard_idx < shard_count_; shard_idx++) {
+		Shard& s = shards_[shard_idx];
+		QMutexLocker lk(&s.lock);
+		total += s.in_size + s.main_size;
+	}
+	return total;
+}
+
+void ChunkCache::erase(Shard& s, EntryList::iterator entry_it) {
+	s.entries.remove(entry_it->key);
+	if(entry_it->in_main) {
+		s.main_size -= entry_it->cost();
+		s.main_queue.erase(entry_it);
+	}else{
+		s.in_size -= entry_it->cost();
+		s.in_queue.erase(entry_it);
+	}
+}
+
+void ChunkCache::evict(Shard& s) {
+	while(s.in_size + s.main_size > shard_capacity_) {
+		bool from_in = s.in_size > shard_capacity_ / 4 || s.main_queue.empty();
+		EntryList::iterator victim = std::prev(from_in ? s.in_queue.end() : s.main_queue.end());
+
+		if(victim->owner)
+			victim->owner->evictions++;
+		if(from_in) {
+			s.ghosts.push_front(victim->key);
+			s.ghost_index.insert(victim->key, s.ghosts.begin());
+		}
+		erase(s, victim);
+	}
+
+	// Ghosts are only keys, but still are bounded to the number of cached chunks
+	while(s.ghosts.size() > std::max<size_t>(s.entries.size(), 64)) {
+		s.ghost_index.remove(s.ghosts.back());
+		s.ghosts.pop_back();
+	}
+}
+
+/* MemoryCachedStorage */
+MemoryCachedStorage::MemoryCachedStorage(QObject* parent) :
+	QObject(parent),
+	cache_(ChunkCache::get_instance()),
+	counters_(std::make_shared<ChunkCache::Counters>()) {}
 
 bool MemoryCachedStorage::have_chunk(const blob& ct_hash) const noexcept {
-	return cache_.contains(conv_bytearray(ct_hash));
+	return cache_->have_chunk(ct_hash);
 }
 
 QByteArray MemoryCachedStorage::get_chunk(const blob& ct_hash) const {
-	QMutexLocker lk(&cache_lock_);
-
-	QByteArray* cached_chunk = cache_[conv_bytearray(ct_hash)];
-	if(cached_chunk)
-		return *cached_chunk;
-	else
+	QByteArray cached_chunk = cache_->get_chunk(ct_hash);
+	if(cached_chunk.isNull()) {
+		counters_->misses++;
 		throw ChunkStorage::no_such_chunk();
+	}
+	counters_->hits++;
+	return cached_chunk;
 }
 
 void MemoryCachedStorage::put_chunk(const blob& ct_hash, QByteArray data) {
-	QMutexLocker lk(&cache_lock_);
-
-	QByteArray* cached_chunk = new QByteArray(data);
-	cache_.insert(conv_bytearray(ct_hash), cached_chunk, cached_chunk->size());
+	cache_->put_chunk(ct_hash, std::move(data), counters_);
 }
 
 void MemoryCachedStorage::remove_chunk(const blob& ct_hash) noexcept {
-	QMutexLocker lk(&cache_lock_);
+	cache_->remove_chunk(ct_hash);
+}
 
-	cache_.remove(conv_bytearray(ct_hash));
+QJsonObject MemoryCachedStorage::collect_state() {
+	QJsonObject state;
+	state["hits"] = double(counters_->hits);
+	state["misses"] = double(counters_->misses);
+	state["evictions"] = double(counters_->evictions);
+	state["size"] = double(cache_->size());
+	state["capacity"] = double(cache_->capacity());
+	return state;
 }
 
 } /* namespace librevault */
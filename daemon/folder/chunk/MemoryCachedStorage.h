@@ -29,12 +29,76 @@
 #pragma once
 #include "blob.h"
 #include <QByteArray>
-#include <QCache>
+#include <QHash>
+#include <QJsonObject>
 #include <QMutex>
 #include <QObject>
+#include <atomic>
+#include <list>
+#include <memory>
 
 namespace librevault {
 
+/* ChunkCache is a process-wide memory cache of encrypted chunks, shared by all folders. Equal ct_hash means equal content,
+ * so sharing is safe. It is split into shards with their own locks, and uses 2Q replacement: new chunks go to a small FIFO
+ * queue, and only chunks, requested again after being pushed out of it, enter the main LRU queue. So a one-off scan
+ * over many chunks can't flush the hot ones. Buffers are implicitly shared QByteArrays, so hits don't copy data. */
+class ChunkCache {
+public:
+	struct Counters {
+		std::atomic<quint64> hits{0}, misses{0}, evictions{0};
+	};
+
+	static ChunkCache* get_instance();
+
+	bool have_chunk(const blob& ct_hash) const noexcept;
+	QByteArray get_chunk(const blob& ct_hash) const;    // Returns null QByteArray on miss
+	void put_chunk(const blob& ct_hash, QByteArray data, std::shared_ptr<Counters> owner);
+	void remove_chunk(const blob& ct_hash) noexcept;
+
+	qint64 size() const;
+	qint64 capacity() const {return capacity_;}
+
+private:
+	explicit ChunkCache(qint64 capacity);
+
+	/* A chunk is admitted, if it takes no more than half of a shard. So shards are made large enough for the largest chunk
+	 * (default max_chunksize of Meta, plus encryption padding and entry overhead), even if there are fewer of them */
+	static constexpr unsigned max_shard_count = 16;
+	static constexpr qint64 max_chunk_cost = 8*1024*1024 + 1024;
+
+	struct Entry {
+		quint64 key;
+		QByteArray ct_hash;
+		QByteArray data;
+		std::shared_ptr<Counters> owner;    // Folder, that put this chunk. Gets eviction counted
+		bool in_main;                       // Am (main LRU queue) or A1in (FIFO queue)
+
+		qint64 cost() const {return sizeof(Entry) + ct_hash.size() + data.size();}
+	};
+	using EntryList = std::list<Entry>;
+
+	struct Shard {
+		QMutex lock;
+		EntryList in_queue;     // A1in, newest at front
+		EntryList main_queue;   // Am, most recently used at front
+		QHash<quint64, EntryList::iterator> entries;
+		std::list<quint64> ghosts;  // A1out, keys of chunks recently pushed out of in_queue. Newest at front
+		QHash<quint64, std::list<quint64>::iterator> ghost_index;
+		qint64 in_size = 0;
+		qint64 main_size = 0;
+	};
+
+	const qint64 capacity_;
+	const unsigned shard_count_;
+	const qint64 shard_capacity_;
+	std::unique_ptr<Shard[]> shards_;
+
+	Shard& shard(quint64 key) const {return shards_[key % shard_count_];}
+	void erase(Shard& shard, EntryList::iterator entry_it);
+	void evict(Shard& shard);
+};
+
 class MemoryCachedStorage : public QObject {
 	Q_OBJECT
 public:
@@ -45,9 +109,11 @@ public:
 	void put_chunk(const blob& ct_hash, QByteArray data);
 	void remove_chunk(const blob& ct_hash) noexcept;
 
+	QJsonObject collect_state();
+
 private:
-	mutable QMutex cache_lock_;
-	QCache<QByteArray, QByteArray> cache_;
+	ChunkCache* cache_;
+	std::shared_ptr<ChunkCache::Counters> counters_;
 };
 
 } /* namespace librevault */
@@ -0,0 +1,190 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#include "OpenChunkCache.h"
+#include "control/FolderParams.h"
+#include "util/readable.h"
+#include "util/sharded_path.h"
+#include <QDir>
+#include <QFile>
+#include <algorithm>
+#include <limits>
+
+namespace librevault {
+
+OpenChunkCache::OpenChunkCache(const FolderParams& params, QObject* parent) :
+	QObject(parent),
+	params_(params),
+	// QCache counts cost in int, so memory size is clamped to 2 GiB
+	memory_cache_((int)std::min(params.open_cache_memory_size, (qint64)std::numeric_limits<int>::max())),
+	hits_(0),
+	misses_(0) {
+	cache_path_ = params_.system_path + "/open_cache";
+
+	// Entries are associated with revisions of paths only at runtime, so leftovers from the previous run are dropped
+	QDir(cache_path_).removeRecursively();
+}
+
+QString OpenChunkCache::make_cache_path(const QByteArray& ct_hash) const {
+	return make_sharded_path(cache_path_, "chunk-", ct_hash);
+}
+
+QByteArray OpenChunkCache::get_chunk(const blob& ct_hash) {
+	QByteArray ct_hash_ba = conv_bytearray(ct_hash);
+	{
+		QMutexLocker lk(&cache_lock_);
+
+		QByteArray* cached_chunk = memory_cache_[ct_hash_ba];
+		if(cached_chunk) {
+			hits_++;
+			return *cached_chunk;
+		}
+
+		auto entry_it = disk_entries_.find(ct_hash_ba);
+		if(entry_it == disk_entries_.end()) {
+			misses_++;
+			return QByteArray();
+		}
+		touch(ct_hash_ba, *entry_it);
+	}
+
+	// Read outside of the lock. The entry can be evicted meanwhile, then it is just a miss.
+	QFile f(make_cache_path(ct_hash_ba));
+	QByteArray chunk;
+	if(f.open(QIODevice::ReadOnly))
+		chunk = f.readAll();
+
+	QMutexLocker lk(&cache_lock_);
+	auto entry_it = disk_entries_.find(ct_hash_ba);
+	if(entry_it == disk_entries_.end() || entry_it->size != chunk.size()) {
+		misses_++;
+		return QByteArray();
+	}
+
+	hits_++;
+	memory_cache_.insert(ct_hash_ba, new QByteArray(chunk), chunk.size());
+	return chunk;
+}
+
+void OpenChunkCache::put_chunk(const blob& path_id, const blob& ct_hash, const QByteArray& chunk) {
+	QByteArray ct_hash_ba = conv_bytearray(ct_hash);
+
+	bool write_disk = chunk.size() <= params_.open_cache_disk_size;
+	if(write_disk) {
+		QString chunk_path = make_cache_path(ct_hash_ba);
+		QDir().mkpath(QFileInfo(chunk_path).path());
+
+		// Plain write, not QSaveFile: the cache is wiped on every start, so syncing it to disk buys nothing.
+		// A torn file is caught by the size check in get_chunk
+		QFile f(chunk_path);
+		write_disk = f.open(QIODevice::WriteOnly | QIODevice::Truncate) && f.write(chunk) == chunk.size();
+		if(!write_disk)
+			LOGW("Could not write" << ct_hash_readable(ct_hash) << "into cache:" << f.errorString());
+	}
+
+	QMutexLocker lk(&cache_lock_);
+
+	memory_cache_.insert(ct_hash_ba, new QByteArray(chunk), chunk.size());
+	path_chunks_[conv_bytearray(path_id)].insert(ct_hash_ba);
+	chunk_paths_[ct_hash_ba].insert(conv_bytearray(path_id));
+
+	if(write_disk && !disk_entries_.contains(ct_hash_ba)) {
+		DiskEntry& entry = disk_entries_[ct_hash_ba];
+		entry.size = chunk.size();
+		disk_size_ += entry.size;
+		touch(ct_hash_ba, entry);
+
+		while(disk_size_ > params_.open_cache_disk_size && !disk_lru_.isEmpty()) {
+			QByteArray evicted_hash = disk_lru_.first();
+			remove_entry(evicted_hash);
+			unlink_paths(evicted_hash);
+		}
+	}
+
+	prune_paths();
+}
+
+void OpenChunkCache::invalidate(const blob& path_id) {
+	QMutexLocker lk(&cache_lock_);
+
+	for(const QByteArray& ct_hash : path_chunks_.take(conv_bytearray(path_id))) {
+		remove_entry(ct_hash);
+		unlink_paths(ct_hash);
+	}
+}
+
+QJsonObject OpenChunkCache::collect_state() {
+	QMutexLocker lk(&cache_lock_);
+
+	QJsonObject state;
+	state["hits"] = double(hits_);
+	state["misses"] = double(misses_);
+	state["memory_size"] = double(memory_cache_.totalCost());
+	state["disk_size"] = double(disk_size_);
+	return state;
+}
+
+void OpenChunkCache::touch(const QByteArray& ct_hash, DiskEntry& entry) {
+	disk_lru_.remove(entry.last_access);
+	entry.last_access = ++access_counter_;
+	disk_lru_.insert(entry.last_access, ct_hash);
+}
+
+void OpenChunkCache::remove_entry(const QByteArray& ct_hash) {
+	memory_cache_.remove(ct_hash);
+
+	auto entry_it = disk_entries_.find(ct_hash);
+	if(entry_it != disk_entries_.end()) {
+		disk_lru_.remove(entry_it->last_access);
+		disk_size_ -= entry_it->size;
+		disk_entries_.erase(entry_it);
+		QFile::remove(make_cache_path(ct_hash));
+	}
+}
+
+void OpenChunkCache::unlink_paths(const QByteArray& ct_hash) {
+	for(const QByteArray& path_id : chunk_paths_.take(ct_hash)) {
+		auto path_it = path_chunks_.find(path_id);
+		if(path_it == path_chunks_.end()) continue;
+		path_it->remove(ct_hash);
+		if(path_it->isEmpty())
+			path_chunks_.erase(path_it);
+	}
+}
+
+void OpenChunkCache::prune_paths() {
+	// Memory-only entries are evicted by QCache silently. Their links are swept, when they outnumber live entries,
+	// so the sweep is amortized over insertions
+	if(chunk_paths_.size() <= 2 * (disk_entries_.size() + memory_cache_.count())) return;
+
+	for(const QByteArray& ct_hash : chunk_paths_.keys())
+		if(!disk_entries_.contains(ct_hash) && !memory_cache_.contains(ct_hash))
+			unlink_paths(ct_hash);
+}
+
+} /* namespace librevault */
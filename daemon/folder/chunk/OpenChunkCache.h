@@ -0,0 +1,87 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#pragma once
+#include "blob.h"
+#include "util/log.h"
+#include <QCache>
+#include <QHash>
+#include <QJsonObject>
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <atomic>
+
+namespace librevault {
+
+class FolderParams;
+
+/* OpenChunkCache keeps chunks, encrypted by OpenStorage, so seeding a chunk to many peers encrypts it only once.
+ * Chunks are kept in memory and written through to system_path/open_cache, both bounded by size. Disk entries are evicted
+ * in LRU order. Entries are remembered per path_id and dropped, when a new revision of this path is indexed. */
+class OpenChunkCache : public QObject {
+	Q_OBJECT
+	LOG_SCOPE("OpenChunkCache");
+public:
+	OpenChunkCache(const FolderParams& params, QObject* parent);
+
+	QByteArray get_chunk(const blob& ct_hash);  // Returns null QByteArray on miss
+	void put_chunk(const blob& path_id, const blob& ct_hash, const QByteArray& chunk);
+	void invalidate(const blob& path_id);
+
+	QJsonObject collect_state();
+
+private:
+	const FolderParams& params_;
+	QString cache_path_;
+
+	struct DiskEntry {
+		qint64 size = 0;
+		quint64 last_access = 0;
+	};
+
+	QMutex cache_lock_;
+	QCache<QByteArray, QByteArray> memory_cache_;   // ct_hash -> chunk
+	QHash<QByteArray, DiskEntry> disk_entries_;     // ct_hash -> DiskEntry
+	QMap<quint64, QByteArray> disk_lru_;            // last_access -> ct_hash
+	qint64 disk_size_ = 0;
+	quint64 access_counter_ = 0;
+	QHash<QByteArray, QSet<QByteArray>> path_chunks_;   // path_id -> ct_hashes
+	QHash<QByteArray, QSet<QByteArray>> chunk_paths_;   // ct_hash -> path_ids, so evicted chunks are unlinked from their paths
+
+	std::atomic<quint64> hits_, misses_;
+
+	QString make_cache_path(const QByteArray& ct_hash) const;
+	void touch(const QByteArray& ct_hash, DiskEntry& entry);
+	void remove_entry(const QByteArray& ct_hash);
+	void unlink_paths(const QByteArray& ct_hash);
+	void prune_paths();
+};
+
+} /* namespace librevault */
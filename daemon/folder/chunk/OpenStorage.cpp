@@ -27,10 +27,12 @@
  * files in the program, then also delete it here.
  */
 #include "OpenStorage.h"
+#include "OpenChunkCache.h"
 #include "control/FolderParams.h"
 #include "folder/chunk/ChunkStorage.h"
 #include "folder/meta/MetaStorage.h"
 #include "folder/PathNormalizer.h"
+#include "util/file_pread.h"
 #include "util/readable.h"
 
 namespace librevault {
@@ -39,7 +41,12 @@ OpenStorage::OpenStorage(const FolderParams& params, MetaStorage* meta_storage,
 	QObject(parent),
 	params_(params),
 	meta_storage_(meta_storage),
-	path_normalizer_(path_normalizer) {}
+	path_normalizer_(path_normalizer) {
+	cache_ = new OpenChunkCache(params_, this);
+	connect(meta_storage_, &MetaStorage::metaAdded, cache_, [this](SignedMeta smeta){
+		cache_->invalidate(smeta.meta().path_id());
+	});
+}
 
 bool OpenStorage::have_chunk(const blob& ct_hash) const noexcept {
 	return meta_storage_->isChunkAssembled(ct_hash);
@@ -48,6 +55,10 @@ bool OpenStorage::have_chunk(const blob& ct_hash) const noexcept {
 QByteArray OpenStorage::get_chunk(const blob& ct_hash) const {
 	LOGD("get_chunk(" << ct_hash_readable(ct_hash) << ")");
 
+	QByteArray cached_chunk = cache_->get_chunk(ct_hash);
+	if(!cached_chunk.isNull())
+		return cached_chunk;
+
 	foreach(auto& smeta, meta_storage_->containingChunk(ct_hash)) {
 		// Search for chunk offset and index
 		uint64_t offset = 0;
@@ -71,9 +82,39 @@ QByteArray OpenStorage::get_chunk(const blob& ct_hash) const {
 		blob chunk_ct = Meta::Chunk::encrypt(chunk_pt, params_.secret.get_Encryption_Key(), chunk.iv);
 
 		// Check
-		if(verify_chunk(ct_hash, chunk_ct, smeta.meta().strong_hash_type())) return conv_bytearray(chunk_ct);
+		if(verify_chunk(ct_hash, chunk_ct, smeta.meta().strong_hash_type())) {
+			QByteArray chunk_ct_ba = conv_bytearray(chunk_ct);
+			cache_->put_chunk(smeta.meta().path_id(), ct_hash, chunk_ct_ba);
+			return chunk_ct_ba;
+		}
+	}
+
+	// Files, which still have the layout of an older revision, than the one in index
+	foreach(auto& ondisk_chunk, meta_storage_->onDiskContainingChunk(ct_hash)) {
+		try {
+			if(ondisk_chunk.iv.empty()) continue;
+			SignedMeta smeta = meta_storage_->getMeta(ondisk_chunk.path_id);   // For the path only, the chunk may be missing from the current revision
+
+			blob chunk_pt = blob(ondisk_chunk.size);
+
+			QFile f(path_normalizer_->denormalizePath(QByteArray::fromStdString(smeta.meta().path(params_.secret))));
+			if(! f.open(QIODevice::ReadOnly)) continue;
+			if(file_pread(f, reinterpret_cast<char*>(chunk_pt.data()), chunk_pt.size(), ondisk_chunk.offset) != (qint64)chunk_pt.size()) continue;
+
+			blob chunk_ct = Meta::Chunk::encrypt(chunk_pt, params_.secret.get_Encryption_Key(), ondisk_chunk.iv);
+
+			if(verify_chunk(ct_hash, chunk_ct, smeta.meta().strong_hash_type())) {
+				QByteArray chunk_ct_ba = conv_bytearray(chunk_ct);
+				cache_->put_chunk(smeta.meta().path_id(), ct_hash, chunk_ct_ba);
+				return chunk_ct_ba;
+			}
+		}catch(MetaStorage::no_such_meta& e) {}
 	}
 	throw ChunkStorage::no_such_chunk();
 }
 
+QJsonObject OpenStorage::collect_state() {
+	return cache_->collect_state();
+}
+
 } /* namespace librevault */
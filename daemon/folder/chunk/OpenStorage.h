@@ -30,6 +30,7 @@
 #include "blob.h"
 #include "util/log.h"
 #include <librevault/Meta.h>
+#include <QJsonObject>
 #include <QObject>
 #include <memory>
 
@@ -39,6 +40,7 @@ class FolderParams;
 class Secret;
 class MetaStorage;
 class PathNormalizer;
+class OpenChunkCache;
 
 class OpenStorage : public QObject {
 	Q_OBJECT
@@ -49,10 +51,13 @@ public:
 	bool have_chunk(const blob& ct_hash) const noexcept;
 	QByteArray get_chunk(const blob& ct_hash) const;
 
+	QJsonObject collect_state();
+
 private:
 	const FolderParams& params_;
 	MetaStorage* meta_storage_;
 	PathNormalizer* path_normalizer_;
+	OpenChunkCache* cache_;
 
 	inline bool verify_chunk(const blob& ct_hash, const blob& chunk_pt, Meta::StrongHashType strong_hash_type) const {
 		return ct_hash == Meta::Chunk::compute_strong_hash(chunk_pt, strong_hash_type);
@@ -0,0 +1,148 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#include "FileEncStorage.h"
+#include "control/FolderParams.h"
+#include "folder/chunk/ChunkStorage.h"
+#include "util/ct_hash_key.h"
+#include "util/file_pread.h"
+#include "util/readable.h"
+#include "util/sharded_path.h"
+#include <librevault/crypto/Base32.h>
+#include <QDir>
+#include <QDirIterator>
+
+namespace librevault {
+
+FileEncStorage::FileEncStorage(const FolderParams& params, QObject* parent) : EncStorageBackend(parent), params_(params) {
+	chunks_path_ = params_.system_path + "/chunks";
+	migrateFlatLayout();
+	loadChunks();
+}
+
+blob FileEncStorage::parse_chunk_ct_name(const QString& name) {
+	QByteArray encoded = name.mid(6).toLatin1();
+	return crypto::Base32().from(blob(encoded.begin(), encoded.end()));
+}
+
+void FileEncStorage::migrateFlatLayout() {
+	// Earlier versions kept all chunks directly in system_path
+	QStringList flat_chunks = QDir(params_.system_path).entryList({"chunk-*"}, QDir::Files);
+	if(flat_chunks.isEmpty())
+		return;
+
+	LOGI("Moving" << flat_chunks.size() << "encrypted chunks into sharded layout");
+	for(const QString& name : flat_chunks) {
+		try {
+			QString new_path = make_chunk_ct_path(parse_chunk_ct_name(name));
+			QDir().mkpath(QFileInfo(new_path).path());
+			if(!QFile::rename(params_.system_path + "/" + name, new_path))
+				LOGW("Could not move" << name << "into sharded layout");
+		}catch(std::exception& e) {
+			LOGW("Skipping malformed chunk file name:" << name);
+		}
+	}
+}
+
+void FileEncStorage::loadChunks() {
+	QWriteLocker lk(&storage_mtx_);
+	chunks_.clear();
+
+	QDirIterator it(chunks_path_, {"chunk-*"}, QDir::Files, QDirIterator::Subdirectories);
+	while(it.hasNext()) {
+		it.next();
+		try {
+			chunks_.insert(ct_hash_key(parse_chunk_ct_name(it.fileName())));
+		}catch(std::exception& e) {
+			LOGW("Skipping malformed chunk file name:" << it.fileName());
+		}
+	}
+
+	LOGD("Loaded" << chunks_.size() << "encrypted chunks");
+}
+
+QString FileEncStorage::make_chunk_ct_path(const blob& ct_hash) const noexcept {
+	return make_chunk_ct_path(conv_bytearray(ct_hash));
+}
+
+QString FileEncStorage::make_chunk_ct_path(QByteArray ct_hash) const noexcept {
+	return make_sharded_path(chunks_path_, "chunk-", ct_hash);
+}
+
+bool FileEncStorage::have_chunk(const blob& ct_hash) const noexcept {
+	QReadLocker lk(&storage_mtx_);
+	return chunks_.contains(ct_hash_key(ct_hash));
+}
+
+QByteArray FileEncStorage::get_chunk(const blob& ct_hash) const {
+	QReadLocker lk(&storage_mtx_);
+
+	QFile chunk_file(make_chunk_ct_path(ct_hash));
+	if(!chunk_file.open(QIODevice::ReadOnly))
+		throw ChunkStorage::no_such_chunk();
+
+	return chunk_file.readAll();
+}
+
+blob FileEncStorage::get_block(const blob& ct_hash, uint32_t offset, uint32_t size) const {
+	QReadLocker lk(&storage_mtx_);
+
+	QFile chunk_file(make_chunk_ct_path(ct_hash));
+	if(!chunk_file.open(QIODevice::ReadOnly) || (qint64)offset + size > chunk_file.size())
+		throw ChunkStorage::no_such_chunk();
+
+	blob block(size);
+	if(file_pread(chunk_file, (char*)block.data(), size, offset) != size)
+		throw ChunkStorage::no_such_chunk();
+	return block;
+}
+
+void FileEncStorage::put_chunk(const QByteArray& ct_hash, QFile* chunk_f) {
+	QWriteLocker lk(&storage_mtx_);
+
+	chunk_f->setParent(this);
+	QString chunk_path = make_chunk_ct_path(ct_hash);
+	QDir().mkpath(QFileInfo(chunk_path).path());
+	if(chunk_f->rename(chunk_path))
+		chunks_.insert(ct_hash_key(ct_hash));
+	else
+		LOGW("Could not move encrypted block" << ct_hash_readable(ct_hash) << "into EncStorage:" << chunk_f->errorString());
+	chunk_f->deleteLater();
+
+	LOGD("Encrypted block" << ct_hash_readable(ct_hash) << "pushed into EncStorage");
+}
+
+void FileEncStorage::remove_chunk(const blob& ct_hash) {
+	QWriteLocker lk(&storage_mtx_);
+	QFile::remove(make_chunk_ct_path(ct_hash));
+	chunks_.remove(ct_hash_key(ct_hash));
+
+	LOGD("Block" << ct_hash_readable(ct_hash) << "removed from EncStorage");
+}
+
+} /* namespace librevault */
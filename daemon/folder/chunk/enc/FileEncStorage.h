@@ -0,0 +1,66 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#pragma once
+#include "folder/chunk/EncStorage.h"
+#include <QReadWriteLock>
+#include <QSet>
+
+namespace librevault {
+
+/* Keeps every encrypted chunk in a separate "chunk-<base32>" file under system_path/chunks */
+class FileEncStorage : public EncStorageBackend {
+	Q_OBJECT
+	LOG_SCOPE("FileEncStorage");
+public:
+	FileEncStorage(const FolderParams& params, QObject* parent);
+
+	bool have_chunk(const blob& ct_hash) const noexcept override;
+	QByteArray get_chunk(const blob& ct_hash) const override;
+	blob get_block(const blob& ct_hash, uint32_t offset, uint32_t size) const override;
+	void put_chunk(const QByteArray& ct_hash, QFile* chunk_f) override;
+	void remove_chunk(const blob& ct_hash) override;
+
+private:
+	const FolderParams& params_;
+	mutable QReadWriteLock storage_mtx_;
+
+	/* Presence index of stored chunks, guarded by storage_mtx_. Keeps have_chunk away from the filesystem */
+	QSet<quint64> chunks_; // ct_hash_key
+
+	QString chunks_path_;
+
+	void migrateFlatLayout();
+	void loadChunks();
+
+	static blob parse_chunk_ct_name(const QString& name);   // Throws on malformed name
+	QString make_chunk_ct_path(const blob& ct_hash) const noexcept;
+	QString make_chunk_ct_path(QByteArray ct_hash) const noexcept;
+};
+
+} /* namespace librevault */
@@ -0,0 +1,355 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#include "PackedEncStorage.h"
+#include "control/FolderParams.h"
+#include "folder/chunk/ChunkStorage.h"
+#include "util/FutureRunnable.h"
+#include "util/ct_hash_key.h"
+#include "util/file_pread.h"
+#include "util/file_sync.h"
+#include "util/readable.h"
+#include <librevault/crypto/Base32.h>
+#include <QDir>
+#include <QDirIterator>
+
+namespace librevault {
+
+PackedEncStorage::PackedEncStorage(const FolderParams& params, QObject* parent) :
+	EncStorageBackend(parent),
+	params_(params),
+	stopping_(false) {
+	packs_path_ = params_.system_path + "/packs";
+	QDir().mkpath(packs_path_);
+
+	db_ = std::make_unique<SQLiteDB>((params_.system_path + "/packs.db").toStdString().c_str());
+	db_->exec("PRAGMA journal_mode=WAL;");
+	db_->exec("PRAGMA synchronous=NORMAL;");
+	db_->exec("CREATE TABLE IF NOT EXISTS chunks (ct_hash BLOB PRIMARY KEY NOT NULL, segment INTEGER NOT NULL, offset INTEGER NOT NULL, size INTEGER NOT NULL);");
+	db_->exec("CREATE INDEX IF NOT EXISTS chunks_segment_idx ON chunks (segment, offset);");
+
+	compaction_pool_ = new QThreadPool(this);
+	compaction_pool_->setMaxThreadCount(1);
+
+	loadIndex();
+	importLooseChunks();
+
+	QWriteLocker lk(&storage_mtx_);
+	for(quint32 segment : segments_.keys()) {
+		if(needsCompaction(segment)) {
+			scheduleCompaction();
+			break;
+		}
+	}
+}
+
+PackedEncStorage::~PackedEncStorage() {
+	stopping_ = true;
+	if(compaction_.valid())
+		compaction_.wait();
+}
+
+void PackedEncStorage::loadIndex() {
+	QWriteLocker lk(&storage_mtx_);
+
+	for(const QString& name : QDir(packs_path_).entryList({"pack-*"}, QDir::Files)) {
+		bool ok = false;
+		quint32 segment = name.mid(5).toUInt(&ok);
+		if(ok)
+			openSegment(segment);
+	}
+
+	std::vector<blob> dangling;
+	for(auto row : db_->exec("SELECT ct_hash, segment, offset, size FROM chunks;")) {
+		Location location{(quint32)row[1].as_uint(), row[2].as_int(), row[3].as_int()};
+
+		auto segment_it = segments_.find(location.segment);
+		if(segment_it == segments_.end() || segment_it->size < location.offset + location.size) {
+			dangling.push_back(row[0].as_blob());
+			continue;
+		}
+
+		chunks_.insert(ct_hash_key(row[0].blob_ptr(), row[0].data_size()), location);
+		segment_it->live_size += location.size;
+	}
+
+	if(!dangling.empty()) {
+		LOGW("Dropping" << dangling.size() << "chunks, that point outside of existing segments");
+		for(auto& ct_hash : dangling)
+			db_->prepare("DELETE FROM chunks WHERE ct_hash=?;").exec({ct_hash});
+	}
+
+	if(segments_.isEmpty())
+		openSegment(0);
+	active_segment_ = segments_.lastKey();
+
+	LOGD("Loaded" << chunks_.size() << "encrypted chunks in" << segments_.size() << "segments");
+}
+
+void PackedEncStorage::importLooseChunks() {
+	// Chunks, left by FileEncStorage, if this folder has been switched to packed storage. Both flat and sharded layouts.
+	QStringList loose_chunks;
+	for(const QString& name : QDir(params_.system_path).entryList({"chunk-*"}, QDir::Files))
+		loose_chunks.append(params_.system_path + "/" + name);
+	QDirIterator it(params_.system_path + "/chunks", {"chunk-*"}, QDir::Files, QDirIterator::Subdirectories);
+	while(it.hasNext())
+		loose_chunks.append(it.next());
+
+	for(const QString& path : loose_chunks) {
+		QString name = QFileInfo(path).fileName();
+		QByteArray encoded = name.mid(6).toLatin1();
+		blob ct_hash;
+		try {
+			ct_hash = crypto::Base32().from(blob(encoded.begin(), encoded.end()));
+		}catch(std::exception& e) {
+			LOGW("Skipping malformed chunk file name:" << name);
+			continue;
+		}
+
+		QFile* chunk_f = new QFile(path);
+		if(chunk_f->open(QIODevice::ReadOnly))
+			put_chunk(conv_bytearray(ct_hash), chunk_f);
+		else
+			delete chunk_f;
+	}
+}
+
+QString PackedEncStorage::make_segment_path(quint32 segment) const {
+	return packs_path_ + "/pack-" + QString::number(segment).rightJustified(8, '0');
+}
+
+void PackedEncStorage::openSegment(quint32 segment) {
+	auto file = std::make_shared<QFile>(make_segment_path(segment));
+	if(!file->open(QIODevice::ReadWrite | QIODevice::Unbuffered))
+		throw std::runtime_error(QString("Could not open segment %1: %2").arg(file->fileName()).arg(file->errorString()).toStdString());
+
+	Segment& s = segments_[segment];
+	s.file = file;
+	s.size = file->size();
+}
+
+PackedEncStorage::Location PackedEncStorage::append(const QByteArray& data) {
+	if(segments_[active_segment_].size > 0 && segments_[active_segment_].size + data.size() > params_.enc_pack_segment_size) {
+		openSegment(active_segment_ + 1);
+		active_segment_++;
+	}
+
+	Segment& active = segments_[active_segment_];
+	if(!active.file->seek(active.size) || active.file->write(data) != data.size())
+		throw std::runtime_error(active.file->errorString().toStdString());
+
+	// Data must be durable before the index row, that points at it, is committed. Otherwise a crash leaves rows over torn bytes
+	if(!file_sync(*active.file))
+		throw std::runtime_error(("Could not sync segment: " + active.file->errorString()).toStdString());
+
+	Location location{active_segment_, active.size, data.size()};
+	active.size += data.size();
+	return location;
+}
+
+bool PackedEncStorage::have_chunk(const blob& ct_hash) const noexcept {
+	QReadLocker lk(&storage_mtx_);
+	return chunks_.contains(ct_hash_key(ct_hash));
+}
+
+QByteArray PackedEncStorage::get_chunk(const blob& ct_hash) const {
+	QReadLocker lk(&storage_mtx_);
+
+	auto it = chunks_.find(ct_hash_key(ct_hash));
+	if(it == chunks_.end())
+		throw ChunkStorage::no_such_chunk();
+
+	QByteArray chunk(it->size, Qt::Uninitialized);
+	if(file_pread(*segments_.value(it->segment).file, chunk.data(), chunk.size(), it->offset) != chunk.size()) {
+		LOGW("Could not read encrypted block" << ct_hash_readable(ct_hash) << "from segment" << it->segment);
+		throw ChunkStorage::no_such_chunk();
+	}
+	return chunk;
+}
+
+blob PackedEncStorage::get_block(const blob& ct_hash, uint32_t offset, uint32_t size) const {
+	QReadLocker lk(&storage_mtx_);
+
+	auto it = chunks_.find(ct_hash_key(ct_hash));
+	if(it == chunks_.end() || (qint64)offset + size > it->size)
+		throw ChunkStorage::no_such_chunk();
+
+	blob block(size);
+	if(file_pread(*segments_.value(it->segment).file, (char*)block.data(), size, it->offset + offset) != size) {
+		LOGW("Could not read encrypted block" << ct_hash_readable(ct_hash) << "from segment" << it->segment);
+		throw ChunkStorage::no_such_chunk();
+	}
+	return block;
+}
+
+void PackedEncStorage::put_chunk(const QByteArray& ct_hash, QFile* chunk_f) {
+	QWriteLocker lk(&storage_mtx_);
+
+	chunk_f->setParent(this);
+	chunk_f->deleteLater();
+
+	quint64 key = ct_hash_key(ct_hash);
+	if(!chunks_.contains(key)) {
+		try {
+			chunk_f->seek(0);
+			Location location = append(chunk_f->readAll());
+
+			blob ct_hash_blob = conv_bytearray(ct_hash);
+			db_->prepare("INSERT OR REPLACE INTO chunks (ct_hash, segment, offset, size) VALUES (?, ?, ?, ?);")
+				.exec({ct_hash_blob, (uint64_t)location.segment, (int64_t)location.offset, (int64_t)location.size});
+
+			chunks_.insert(key, location);
+			segments_[location.segment].live_size += location.size;
+
+			LOGD("Encrypted block" << ct_hash_readable(ct_hash) << "pushed into segment" << location.segment);
+		}catch(std::exception& e) {
+			LOGW("Could not pack encrypted block" << ct_hash_readable(ct_hash) << ":" << e.what());
+			return;
+		}
+	}
+	chunk_f->remove();
+}
+
+void PackedEncStorage::remove_chunk(const blob& ct_hash) {
+	QWriteLocker lk(&storage_mtx_);
+
+	auto it = chunks_.find(ct_hash_key(ct_hash));
+	if(it == chunks_.end())
+		return;
+
+	Location location = *it;
+	db_->prepare("DELETE FROM chunks WHERE ct_hash=?;").exec({ct_hash});
+	chunks_.erase(it);
+	segments_[location.segment].live_size -= location.size;
+
+	LOGD("Block" << ct_hash_readable(ct_hash) << "removed from segment" << location.segment);
+
+	if(needsCompaction(location.segment))
+		scheduleCompaction();
+}
+
+bool PackedEncStorage::needsCompaction(quint32 segment) const {
+	if(segment == active_segment_)
+		return false;
+
+	Segment s = segments_.value(segment);
+	return s.size > 0 && (s.size - s.live_size) >= s.size * params_.enc_pack_compact_ratio;
+}
+
+void PackedEncStorage::scheduleCompaction() {
+	if(compaction_running_)
+		return;
+
+	compaction_running_ = true;
+	compaction_ = run_future<void>(compaction_pool_, [this]{compact();});
+}
+
+void PackedEncStorage::compact() {
+	while(!stopping_) {
+		quint32 segment = 0;
+		bool found = false;
+		{
+			QWriteLocker lk(&storage_mtx_);
+			for(quint32 candidate : segments_.keys()) {
+				if(needsCompaction(candidate)) {
+					segment = candidate;
+					found = true;
+					break;
+				}
+			}
+			if(!found) {
+				compaction_running_ = false;
+				return;
+			}
+		}
+
+		try {
+			compactSegment(segment);
+		}catch(std::exception& e) {
+			LOGW("Compaction of segment" << segment << "failed:" << e.what());
+			break;
+		}
+	}
+
+	QWriteLocker lk(&storage_mtx_);
+	compaction_running_ = false;
+}
+
+void PackedEncStorage::compactSegment(quint32 segment) {
+	LOGD("Compacting segment" << segment);
+
+	QList<QPair<quint64, Location>> live_chunks;
+	{
+		QReadLocker lk(&storage_mtx_);
+		for(auto it = chunks_.begin(); it != chunks_.end(); it++)
+			if(it->segment == segment)
+				live_chunks.append({it.key(), it.value()});
+	}
+
+	// Chunks are copied one by one, so readers and writers are blocked only for a single append
+	for(auto& live_chunk : live_chunks) {
+		if(stopping_)
+			return;
+
+		QByteArray data(live_chunk.second.size, Qt::Uninitialized);
+		{
+			QReadLocker lk(&storage_mtx_);
+			if(!(chunks_.value(live_chunk.first) == live_chunk.second))
+				continue;   // Removed meanwhile
+			if(file_pread(*segments_.value(segment).file, data.data(), data.size(), live_chunk.second.offset) != data.size())
+				throw std::runtime_error("Could not read chunk from segment");
+		}
+
+		QWriteLocker lk(&storage_mtx_);
+		if(!(chunks_.value(live_chunk.first) == live_chunk.second))
+			continue;
+
+		Location moved = append(data);
+		db_->prepare("UPDATE chunks SET segment=?, offset=? WHERE segment=? AND offset=?;")
+			.exec({(uint64_t)moved.segment, (int64_t)moved.offset, (uint64_t)segment, (int64_t)live_chunk.second.offset});
+
+		chunks_[live_chunk.first] = moved;
+		segments_[moved.segment].live_size += moved.size;
+		segments_[segment].live_size -= moved.size;
+	}
+
+	QWriteLocker lk(&storage_mtx_);
+	Segment& s = segments_[segment];
+	if(s.live_size == 0) {
+		// With synchronous=NORMAL, last WAL commits can be lost on power failure. The relocations must reach the database file,
+		// before the only other copy of the chunks is deleted
+		db_->exec("PRAGMA wal_checkpoint(FULL);");
+
+		qint64 reclaimed = s.size;
+		s.file->remove();
+		segments_.remove(segment);
+		LOGD("Segment" << segment << "removed," << reclaimed << "bytes reclaimed");
+	}
+}
+
+} /* namespace librevault */
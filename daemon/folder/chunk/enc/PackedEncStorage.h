@@ -0,0 +1,98 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#pragma once
+#include "folder/chunk/EncStorage.h"
+#include "util/SQLiteWrapper.h"
+#include <QHash>
+#include <QMap>
+#include <QReadWriteLock>
+#include <QThreadPool>
+#include <atomic>
+#include <future>
+#include <memory>
+
+namespace librevault {
+
+/* Appends encrypted chunks to large segment files ("packs/pack-<n>") and keeps their offsets in "packs.db".
+ * Removed chunks leave garbage in segments, which is reclaimed by background compaction. */
+class PackedEncStorage : public EncStorageBackend {
+	Q_OBJECT
+	LOG_SCOPE("PackedEncStorage");
+public:
+	PackedEncStorage(const FolderParams& params, QObject* parent);
+	~PackedEncStorage();
+
+	bool have_chunk(const blob& ct_hash) const noexcept override;
+	QByteArray get_chunk(const blob& ct_hash) const override;
+	blob get_block(const blob& ct_hash, uint32_t offset, uint32_t size) const override;
+	void put_chunk(const QByteArray& ct_hash, QFile* chunk_f) override;
+	void remove_chunk(const blob& ct_hash) override;
+
+private:
+	struct Location {
+		quint32 segment;
+		qint64 offset;
+		qint64 size;
+		bool operator==(const Location& other) const {return segment == other.segment && offset == other.offset && size == other.size;}
+	};
+	struct Segment {
+		std::shared_ptr<QFile> file;
+		qint64 size = 0;        // Total bytes in file
+		qint64 live_size = 0;   // Bytes, referenced by the index
+	};
+
+	const FolderParams& params_;
+	QString packs_path_;
+
+	/* Everything below is guarded by storage_mtx_. Reads share it, while appends, removals and relocations lock it exclusively */
+	mutable QReadWriteLock storage_mtx_;
+	std::unique_ptr<SQLiteDB> db_;
+	QHash<quint64, Location> chunks_;   // ct_hash_key -> Location
+	QMap<quint32, Segment> segments_;
+	quint32 active_segment_ = 0;
+
+	QThreadPool* compaction_pool_;
+	bool compaction_running_ = false;
+	std::atomic<bool> stopping_;
+	std::future<void> compaction_;
+
+	void loadIndex();
+	void importLooseChunks();
+
+	QString make_segment_path(quint32 segment) const;
+	void openSegment(quint32 segment);
+	Location append(const QByteArray& data);
+
+	bool needsCompaction(quint32 segment) const;
+	void scheduleCompaction();
+	void compact();
+	void compactSegment(quint32 segment);
+};
+
+} /* namespace librevault */
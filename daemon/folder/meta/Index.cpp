@@ -30,23 +30,28 @@
 #include "control/FolderParams.h"
 #include "control/StateCollector.h"
 #include "folder/meta/MetaStorage.h"
+#include "util/ct_hash_key.h"
 #include "util/readable.h"
 #include <QFile>
+#include <QThread>
 
 namespace librevault {
 
 Index::Index(const FolderParams& params, StateCollector* state_collector, QObject* parent) : QObject(parent), params_(params), state_collector_(state_collector) {
+	meta_cache_.setMaxCost(params_.meta_cache_size);
+
 	auto db_filepath = params_.system_path + "/librevault.db";
 
 	if(QFile::exists(db_filepath))
 		LOGD("Opening SQLite3 DB:" << db_filepath);
 	else
 		LOGD("Creating new SQLite3 DB:" << db_filepath);
-	db_ = std::make_unique<SQLiteDB>(db_filepath.toStdString());
+	db_ = std::make_unique<SQLiteDB>(db_filepath.toStdString().c_str());
 	db_->exec("PRAGMA foreign_keys = ON;");
+	applyStorageProfile();
 
 	/* TABLE meta */
-	db_->exec("CREATE TABLE IF NOT EXISTS meta (path_id BLOB PRIMARY KEY NOT NULL, meta BLOB NOT NULL, signature BLOB NOT NULL, type INTEGER NOT NULL, assembled BOOLEAN DEFAULT (0) NOT NULL);");
+	db_->exec("CREATE TABLE IF NOT EXISTS meta (path_id BLOB PRIMARY KEY NOT NULL, meta BLOB NOT NULL, signature BLOB NOT NULL, type INTEGER NOT NULL, assembled BOOLEAN DEFAULT (0) NOT NULL, size INTEGER DEFAULT (0) NOT NULL, chunks INTEGER DEFAULT (0) NOT NULL, revision INTEGER DEFAULT (0) NOT NULL);");
 	db_->exec("CREATE INDEX IF NOT EXISTS meta_type_idx ON meta (type);");   // For making "COUNT(*) ... WHERE type=x" way faster
 	db_->exec("CREATE INDEX IF NOT EXISTS meta_not_deleted_idx ON meta(type<>255);");   // For faster Index::getExistingMeta
 
@@ -57,7 +62,12 @@ Index::Index(const FolderParams& params, StateCollector* state_collector, QObjec
 	db_->exec("CREATE TABLE IF NOT EXISTS openfs (ct_hash BLOB NOT NULL REFERENCES chunk (ct_hash) ON DELETE CASCADE ON UPDATE CASCADE, path_id BLOB NOT NULL REFERENCES meta (path_id) ON DELETE CASCADE ON UPDATE CASCADE, [offset] INTEGER NOT NULL, assembled BOOLEAN DEFAULT (0) NOT NULL);");
 	db_->exec("CREATE INDEX IF NOT EXISTS openfs_assembled_idx ON openfs (ct_hash, assembled) WHERE assembled = 1;");    // For faster OpenStorage::have_chunk
 	db_->exec("CREATE INDEX IF NOT EXISTS openfs_path_id_fki ON openfs (path_id);");    // For faster AssemblerQueue::assemble_file
-	db_->exec("CREATE IF NOT EXISTS INDEX openfs_ct_hash_fki ON openfs (ct_hash);");    // For faster Index::containingChunk
+	db_->exec("CREATE INDEX IF NOT EXISTS openfs_ct_hash_fki ON openfs (ct_hash);");    // For faster Index::containingChunk
+	/* TABLE ondisk */
+	// Plaintext layout of a file, that is still on disk, while a newer revision of it waits for assembly
+	db_->exec("CREATE TABLE IF NOT EXISTS ondisk (ct_hash BLOB NOT NULL, path_id BLOB NOT NULL, [offset] INTEGER NOT NULL, size INTEGER NOT NULL);");
+	db_->exec("CREATE INDEX IF NOT EXISTS ondisk_path_id_idx ON ondisk (path_id);");
+	db_->exec("CREATE INDEX IF NOT EXISTS ondisk_ct_hash_idx ON ondisk (ct_hash);");
 	//db_->exec("CREATE TRIGGER IF NOT EXISTS chunk_deleter AFTER DELETE ON openfs BEGIN DELETE FROM chunk WHERE ct_hash NOT IN (SELECT ct_hash FROM openfs); END;");   // Damn, there are more problems with this trigger than profit from it. Anyway, we can add it anytime later.
 
 	/* Create a special hash-file */
@@ -72,16 +82,77 @@ Index::Index(const FolderParams& params, StateCollector* state_collector, QObjec
 	hash_file.write(hexhash_conf);
 	hash_file.close();
 
+	migrate();
+	db_->exec("CREATE INDEX IF NOT EXISTS meta_revision_idx ON meta (path_id, revision);");   // Covering index for Index::getRevisions, doesn't touch meta blobs
+	loadStats();
+	loadAssembledChunks();
 	notifyState();
+
+	if(params_.db_wal && params_.db_checkpoint_interval.count() > 0) {
+		checkpoint_timer_ = new QTimer(this);
+		connect(checkpoint_timer_, &QTimer::timeout, this, &Index::checkpoint);
+		checkpoint_timer_->setInterval(std::chrono::duration_cast<std::chrono::milliseconds>(params_.db_checkpoint_interval).count());
+		checkpoint_timer_->setTimerType(Qt::VeryCoarseTimer);
+		checkpoint_timer_->start();
+	}
 }
 
-bool Index::haveMeta(const Meta::PathRevision& path_revision) noexcept {
-	try {
-		getMeta(path_revision);
-	}catch(MetaStorage::no_such_meta& e){
-		return false;
+void Index::applyStorageProfile() {
+	db_->exec(params_.db_wal ? "PRAGMA journal_mode = WAL;" : "PRAGMA journal_mode = DELETE;");
+	if(QStringList({"off", "normal", "full", "extra"}).contains(params_.db_synchronous, Qt::CaseInsensitive))
+		db_->exec("PRAGMA synchronous = " + params_.db_synchronous.toStdString() + ";");
+	applyCacheProfile(*db_);
+}
+
+void Index::applyCacheProfile(SQLiteDB& db) {
+	db.exec("PRAGMA busy_timeout = 10000;");  // Wait for a lock of another connection, instead of failing with SQLITE_BUSY
+	db.exec("PRAGMA mmap_size = " + std::to_string(params_.db_mmap_size) + ";");
+	if(params_.db_cache_size > 0)
+		db.exec("PRAGMA cache_size = -" + std::to_string(params_.db_cache_size) + ";");    // Negative value is in KiB
+	db.exec(params_.db_temp_store_memory ? "PRAGMA temp_store = MEMORY;" : "PRAGMA temp_store = DEFAULT;");
+}
+
+std::shared_ptr<SQLiteDB> Index::readDB() {
+	// Main thread reads through the writer connection, so it sees its own uncommitted changes.
+	// Without WAL readers and the writer lock each other out, so everyone reads through the writer.
+	if(QThread::currentThread() == thread() || !params_.db_wal)
+		return std::shared_ptr<SQLiteDB>(db_.get(), [](SQLiteDB*){});
+
+	SQLiteDB* reader = nullptr;
+	{
+		QMutexLocker lk(&reader_pool_->lock);
+		if(!reader_pool_->readers.empty()) {
+			reader = reader_pool_->readers.back().release();
+			reader_pool_->readers.pop_back();
+		}
 	}
-	return true;
+	if(!reader) {
+		reader = new SQLiteDB((params_.system_path + "/librevault.db").toStdString().c_str(), SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX);
+		applyCacheProfile(*reader);
+	}
+
+	// Connection is returned to the pool, when the last reference is released
+	std::weak_ptr<ReaderPool> pool_weak = reader_pool_;
+	return std::shared_ptr<SQLiteDB>(reader, [pool_weak](SQLiteDB* released){
+		auto pool = pool_weak.lock();
+		if(!pool) {
+			delete released;
+			return;
+		}
+		QMutexLocker lk(&pool->lock);
+		pool->readers.emplace_back(released);
+	});
+}
+
+void Index::checkpoint() {
+	// Passive checkpoint doesn't wait for readers and writers, so it never blocks the index
+	db_->exec("PRAGMA wal_checkpoint(PASSIVE);");
+}
+
+bool Index::haveMeta(const Meta::PathRevision& path_revision) noexcept {
+	auto revisions = getRevisions({path_revision.path_id_});
+	auto it = revisions.find(conv_bytearray(path_revision.path_id_));
+	return it != revisions.end() && it.value() == (qint64)path_revision.revision_;
 }
 
 SignedMeta Index::getMeta(const Meta::PathRevision& path_revision) {
@@ -94,124 +165,415 @@ SignedMeta Index::getMeta(const Meta::PathRevision& path_revision) {
 /* Meta manipulators */
 
 void Index::putMeta(const SignedMeta& signed_meta, bool fully_assembled) {
+	putMeta(QList<SignedMeta>({signed_meta}), fully_assembled);
+}
+
+void Index::putMeta(const QList<SignedMeta>& signed_metas, bool fully_assembled) {
 	LOGFUNC();
-	qsrand(time(nullptr));
-	QString transaction_name = QStringLiteral("put_Meta_%1").arg(qrand());
-	SQLiteSavepoint raii_transaction(*db_, transaction_name.toStdString()); // Begin transaction
-
-	db_->exec("INSERT OR REPLACE INTO meta (path_id, meta, signature, type, assembled) VALUES (:path_id, :meta, :signature, :type, :assembled);", {
-			{":path_id", signed_meta.meta().path_id()},
-			{":meta", signed_meta.raw_meta()},
-			{":signature", signed_meta.signature()},
-			{":type", (uint64_t)signed_meta.meta().meta_type()},
-			{":assembled", (uint64_t)fully_assembled}
-	});
+	if(signed_metas.isEmpty()) return;
 
-	uint64_t offset = 0;
-	for(auto chunk : signed_meta.meta().chunks()){
-		db_->exec("INSERT OR IGNORE INTO chunk (ct_hash, size, iv) VALUES (:ct_hash, :size, :iv);", {
-				{":ct_hash", chunk.ct_hash},
-				{":size", (uint64_t)chunk.size},
-				{":iv", chunk.iv}
-		});
-
-		db_->exec("INSERT OR REPLACE INTO openfs (ct_hash, path_id, [offset], assembled) VALUES (:ct_hash, :path_id, :offset, :assembled);", {
-				{":ct_hash", chunk.ct_hash},
-				{":path_id", signed_meta.meta().path_id()},
-				{":offset", (uint64_t)offset},
-				{":assembled", (uint64_t)fully_assembled}
-		});
+	{
+		QMutexLocker write_lk(&write_lock_);
+		SQLiteSavepoint raii_transaction(*db_, "put_Meta"); // Begin transaction
 
-		offset += chunk.size;
+		Delta delta;
+		for(auto& signed_meta : signed_metas)
+			writeMeta(signed_meta, fully_assembled, delta);
+
+		raii_transaction.commit();  // End transaction
+		applyDelta(delta);
 	}
 
-	raii_transaction.commit();  // End transaction
+	{
+		QMutexLocker lk(&meta_cache_lock_);
+		meta_cache_generation_++;
+		for(auto& signed_meta : signed_metas)
+			meta_cache_.remove(conv_bytearray(signed_meta.meta().path_id()));
+	}
 
-	if(fully_assembled)
-		LOGD("Added fully assembled Meta of " << path_id_readable(signed_meta.meta().path_id()) << " t:" << signed_meta.meta().meta_type());
-	else
-		LOGD("Added Meta of " << path_id_readable(signed_meta.meta().path_id()) << " t:" << signed_meta.meta().meta_type());
+	for(auto& signed_meta : signed_metas) {
+		if(fully_assembled)
+			LOGD("Added fully assembled Meta of " << path_id_readable(signed_meta.meta().path_id()) << " t:" << signed_meta.meta().meta_type());
+		else
+			LOGD("Added Meta of " << path_id_readable(signed_meta.meta().path_id()) << " t:" << signed_meta.meta().meta_type());
 
-	emit metaAdded(signed_meta);
-	if(!fully_assembled)
-		emit metaAddedExternal(signed_meta);
+		emit metaAdded(signed_meta);
+		if(!fully_assembled)
+			emit metaAddedExternal(signed_meta);
+	}
 
 	notifyState();
 }
 
-QList<SignedMeta> Index::getMeta(const std::string& sql, const std::map<std::string, SQLValue>& values){
+void Index::writeMeta(const SignedMeta& signed_meta, bool fully_assembled, Delta& delta) {
+	const blob& path_id = signed_meta.meta().path_id();
+
+	// Entry, that is going to be replaced, is subtracted from statistics
+	for(auto row : db_->prepare("SELECT type, size, chunks FROM meta WHERE path_id=?;").exec({path_id}))
+		delta.stats[(int)row[0].as_int()] -= Stats{1, row[1].as_int(), row[2].as_int()};
+
+	// Until a new revision is assembled, the file on disk keeps the layout of the last assembled one. It is saved into ondisk,
+	// so its chunks stay available and can be reused by the assembler. If the file is already there, the old layout is obsolete.
+	bool have_ondisk = db_->prepare("SELECT 1 FROM ondisk WHERE path_id=? LIMIT 1;").exec({path_id}).have_rows();
+	if(!fully_assembled && !have_ondisk) {
+		db_->prepare("INSERT INTO ondisk (ct_hash, path_id, [offset], size) SELECT openfs.ct_hash, openfs.path_id, openfs.[offset], chunk.size FROM openfs JOIN chunk ON openfs.ct_hash=chunk.ct_hash WHERE openfs.path_id=? AND openfs.assembled=1;").exec({path_id});
+	}else{
+		for(auto row : db_->prepare("SELECT ct_hash FROM openfs WHERE path_id=? AND assembled=1;").exec({path_id}))
+			delta.assembled_chunks[ct_hash_key(row[0].blob_ptr(), row[0].data_size())]--;
+	}
+	if(fully_assembled && have_ondisk) {
+		for(auto row : db_->prepare("SELECT ct_hash FROM ondisk WHERE path_id=?;").exec({path_id})) {
+			delta.assembled_chunks[ct_hash_key(row[0].blob_ptr(), row[0].data_size())]--;
+			delta.ondisk_removed.append(row[0].as_blob());
+		}
+		db_->prepare("DELETE FROM ondisk WHERE path_id=?;").exec({path_id});
+	}
+	db_->prepare("DELETE FROM openfs WHERE path_id=?;").exec({path_id});
+
+	Stats new_stats{1, (qint64)signed_meta.meta().size(), (qint64)signed_meta.meta().chunks().size()};
+	delta.stats[(int)signed_meta.meta().meta_type()] += new_stats;
+
+	db_->prepare("INSERT OR REPLACE INTO meta (path_id, meta, signature, type, assembled, size, chunks, revision) VALUES (?, ?, ?, ?, ?, ?, ?, ?);").exec({
+		path_id,
+		signed_meta.raw_meta(),
+		signed_meta.signature(),
+		(uint64_t)signed_meta.meta().meta_type(),
+		(uint64_t)fully_assembled,
+		(int64_t)new_stats.size,
+		(int64_t)new_stats.chunks,
+		(int64_t)signed_meta.meta().revision()
+	});
+
+	auto& insert_chunk = db_->prepare("INSERT OR IGNORE INTO chunk (ct_hash, size, iv) VALUES (?, ?, ?);");
+	auto& insert_openfs = db_->prepare("INSERT OR REPLACE INTO openfs (ct_hash, path_id, [offset], assembled) VALUES (?, ?, ?, ?);");
+
+	uint64_t offset = 0;
+	for(auto& chunk : signed_meta.meta().chunks()){
+		insert_chunk.exec({chunk.ct_hash, (uint64_t)chunk.size, chunk.iv});
+		insert_openfs.exec({chunk.ct_hash, path_id, offset, (uint64_t)fully_assembled});
+		if(fully_assembled)
+			delta.assembled_chunks[ct_hash_key(chunk.ct_hash)]++;
+
+		offset += chunk.size;
+	}
+}
+
+QList<SignedMeta> Index::getMeta(const std::string& sql, const std::map<std::string, SQLValue>& values, bool populate_cache){
+	quint64 generation;
+	{
+		QMutexLocker lk(&meta_cache_lock_);
+		generation = meta_cache_generation_;
+	}
+
+	auto db = readDB();
+
 	QList<SignedMeta> result_list;
-	for(auto row : db_->exec(sql, values))
-		result_list << SignedMeta(row[0], row[1], params_.secret);
+	for(auto row : db->exec(sql, values)) {
+		QByteArray path_id((const char*)row[0].blob_ptr(), row[0].data_size());
+		{
+			QMutexLocker lk(&meta_cache_lock_);
+			SignedMeta* cached = meta_cache_.object(path_id);
+			if(cached && meta_cache_generation_ == generation) {
+				meta_cache_hits_++;
+				result_list << *cached;
+				continue;
+			}
+		}
+
+		SignedMeta smeta(row[1], row[2], params_.secret);
+		result_list << smeta;
+
+		if(populate_cache) {
+			QMutexLocker lk(&meta_cache_lock_);
+			meta_cache_misses_++;
+			if(meta_cache_generation_ == generation)
+				meta_cache_.insert(path_id, new SignedMeta(smeta));
+		}
+	}
 	return result_list;
 }
 SignedMeta Index::getMeta(const blob& path_id){
-	auto meta_list = getMeta("SELECT meta, signature FROM meta WHERE path_id=:path_id LIMIT 1", {
+	{
+		QMutexLocker lk(&meta_cache_lock_);
+		if(SignedMeta* cached = meta_cache_.object(conv_bytearray(path_id))) {
+			meta_cache_hits_++;
+			return *cached;
+		}
+	}
+
+	auto meta_list = getMeta("SELECT path_id, meta, signature FROM meta WHERE path_id=:path_id LIMIT 1", {
 		{":path_id", path_id}
-	});
+	}, true);
 
 	if(meta_list.empty()) throw MetaStorage::no_such_meta();
 	return *meta_list.begin();
 }
 QList<SignedMeta> Index::getMeta(){
-	return getMeta("SELECT meta, signature FROM meta");
+	return getMeta("SELECT path_id, meta, signature FROM meta");
 }
 
 QList<SignedMeta> Index::getExistingMeta() {
-	return getMeta("SELECT meta, signature FROM meta WHERE (type<>255)=1 AND assembled=1;");
+	return getMeta("SELECT path_id, meta, signature FROM meta WHERE (type<>255)=1 AND assembled=1;");
 }
 
 QList<SignedMeta> Index::getIncompleteMeta() {
-	return getMeta("SELECT meta, signature FROM meta WHERE (type<>255)=1 AND assembled=0;");
+	return getMeta("SELECT path_id, meta, signature FROM meta WHERE (type<>255)=1 AND assembled=0;");
 }
 
 bool Index::putAllowed(const Meta::PathRevision& path_revision) noexcept {
-	try {
-		return getMeta(path_revision.path_id_).meta().revision() < path_revision.revision_;
-	}catch(MetaStorage::no_such_meta& e){
-		return true;
+	auto revisions = getRevisions({path_revision.path_id_});
+	auto it = revisions.find(conv_bytearray(path_revision.path_id_));
+	return it == revisions.end() || it.value() < (qint64)path_revision.revision_;
+}
+
+QHash<QByteArray, qint64> Index::getRevisions(const QList<blob>& path_ids) {
+	const int max_batch = 500;   // SQLite limits the number of bound parameters to 999 by default
+
+	auto db = readDB();
+
+	QHash<QByteArray, qint64> revisions;
+	for(int batch_start = 0; batch_start < path_ids.size(); batch_start += max_batch) {
+		std::string sql = "SELECT path_id, revision FROM meta WHERE path_id IN (";
+		std::map<std::string, SQLValue> values;
+		for(int i = batch_start; i < std::min(batch_start + max_batch, path_ids.size()); i++) {
+			std::string param = ":p" + std::to_string(i - batch_start);
+			sql += (i == batch_start ? "" : ", ") + param;
+			values.emplace(param, path_ids[i]);
+		}
+		sql += ");";
+
+		for(auto row : db->exec(sql, values))
+			revisions.insert(QByteArray((const char*)row[0].blob_ptr(), row[0].data_size()), row[1].as_int());
 	}
+	return revisions;
+}
+
+QList<MetaStorage::MetaSummary> Index::getMetaSummary(const blob& after_path_id, int limit) {
+	auto db = readDB();
+
+	QList<MetaStorage::MetaSummary> summaries;
+	QHash<QByteArray, int> summary_idx;   // path_id -> index in summaries
+	for(auto row : db->exec("SELECT path_id, revision FROM meta WHERE path_id > :after ORDER BY path_id LIMIT :limit;", {
+		{":after", after_path_id},
+		{":limit", (int64_t)limit}
+	})) {
+		MetaStorage::MetaSummary summary;
+		summary.revision.path_id_ = row[0].as_blob();
+		summary.revision.revision_ = row[1].as_int();
+		summary_idx.insert(conv_bytearray(summary.revision.path_id_), summaries.size());
+		summaries << summary;
+	}
+	if(summaries.isEmpty()) return summaries;
+
+	// Chunk lists of the whole page are read with one range scan over openfs_path_id_fki
+	for(auto row : db->exec("SELECT path_id, ct_hash FROM openfs WHERE path_id > :after AND path_id <= :last ORDER BY path_id, [offset];", {
+		{":after", after_path_id},
+		{":last", summaries.last().revision.path_id_}
+	})) {
+		auto idx_it = summary_idx.find(QByteArray((const char*)row[0].blob_ptr(), row[0].data_size()));
+		if(idx_it != summary_idx.end())
+			summaries[idx_it.value()].chunks.push_back(row[1].as_blob());
+	}
+	return summaries;
 }
 
 void Index::setAssembled(blob path_id) {
+	// Called from worker threads, so it must not touch the statement cache of the writer connection.
+	QMutexLocker write_lk(&write_lock_);
+	SQLiteSavepoint raii_transaction(*db_, "Index::setAssembled");
+
+	Delta delta;
+	for(auto row : db_->exec("SELECT ct_hash FROM openfs WHERE path_id=:path_id AND assembled=0", {{":path_id", path_id}}))
+		delta.assembled_chunks[ct_hash_key(row[0].blob_ptr(), row[0].data_size())]++;
+	for(auto row : db_->exec("SELECT ct_hash FROM ondisk WHERE path_id=:path_id", {{":path_id", path_id}})) {
+		delta.assembled_chunks[ct_hash_key(row[0].blob_ptr(), row[0].data_size())]--;
+		delta.ondisk_removed.append(row[0].as_blob());
+	}
+
 	db_->exec("UPDATE meta SET assembled=1 WHERE path_id=:path_id", {{":path_id", path_id}});
 	db_->exec("UPDATE openfs SET assembled=1 WHERE path_id=:path_id", {{":path_id", path_id}});
+	db_->exec("DELETE FROM ondisk WHERE path_id=:path_id", {{":path_id", path_id}});
+
+	raii_transaction.commit();
+	applyDelta(delta);
 }
 
 bool Index::isAssembledChunk(blob ct_hash) {
-	auto sql_result = db_->exec("SELECT assembled FROM openfs WHERE ct_hash=:ct_hash AND openfs.assembled=1 LIMIT 1", {
-		{":ct_hash", ct_hash}
-	});
-	return sql_result.have_rows();
+	QReadLocker lk(&assembled_lock_);
+	return assembled_chunks_.value(ct_hash_key(ct_hash)) > 0;
 }
 
-QPair<quint32, QByteArray> Index::getChunkSizeIv(blob ct_hash) {
-	for(auto row : db_->exec("SELECT size, iv FROM chunk WHERE ct_hash=:ct_hash", {{":ct_hash", ct_hash}})) {
-		return qMakePair(row[0].as_uint(), conv_bytearray(row[1].as_blob()));
-	}
-	throw MetaStorage::no_such_meta();
-};
-
 QList<SignedMeta> Index::containingChunk(const blob& ct_hash) {
-	return getMeta("SELECT meta.meta, meta.signature FROM meta JOIN openfs ON meta.path_id=openfs.path_id WHERE openfs.ct_hash=:ct_hash",
-		{{":ct_hash", ct_hash}});
+	return getMeta("SELECT meta.path_id, meta.meta, meta.signature FROM meta JOIN openfs ON meta.path_id=openfs.path_id WHERE openfs.ct_hash=:ct_hash",
+		{{":ct_hash", ct_hash}}, true);
+}
+
+QList<MetaStorage::OnDiskChunk> Index::getOnDiskChunks(const std::string& sql, const blob& value) {
+	auto db = readDB();
+
+	QList<MetaStorage::OnDiskChunk> result_list;
+	// Not a cached statement, as it can be the writer connection, shared with other threads
+	for(auto row : db->exec(sql, {{":value", value}}))
+		result_list << MetaStorage::OnDiskChunk{row[0].as_blob(), row[1].as_blob(), row[2].as_uint(), (quint32)row[3].as_uint(), row[4].as_blob()};
+	return result_list;
+}
+
+QList<MetaStorage::OnDiskChunk> Index::onDiskChunks(const blob& path_id) {
+	return getOnDiskChunks("SELECT ondisk.ct_hash, ondisk.path_id, ondisk.[offset], ondisk.size, chunk.iv FROM ondisk LEFT JOIN chunk ON ondisk.ct_hash=chunk.ct_hash WHERE ondisk.path_id=:value ORDER BY ondisk.[offset];", path_id);
+}
+
+QList<MetaStorage::OnDiskChunk> Index::onDiskContainingChunk(const blob& ct_hash) {
+	return getOnDiskChunks("SELECT ondisk.ct_hash, ondisk.path_id, ondisk.[offset], ondisk.size, chunk.iv FROM ondisk LEFT JOIN chunk ON ondisk.ct_hash=chunk.ct_hash WHERE ondisk.ct_hash=:value;", ct_hash);
 }
 
 void Index::wipe() {
+	QMutexLocker write_lk(&write_lock_);
 	SQLiteSavepoint savepoint(*db_, "Index::wipe");
 	db_->exec("DELETE FROM meta");
 	db_->exec("DELETE FROM chunk");
 	db_->exec("DELETE FROM openfs");
+	db_->exec("DELETE FROM ondisk");
 	savepoint.commit();
 	db_->exec("VACUUM");
+	stats_.clear();
+
+	{
+		QMutexLocker lk(&meta_cache_lock_);
+		meta_cache_generation_++;
+		meta_cache_.clear();
+	}
+
+	QWriteLocker lk(&assembled_lock_);
+	assembled_chunks_.clear();
+}
+
+void Index::migrate() {
+	int64_t version = 0;
+	for(auto row : db_->exec("PRAGMA user_version;"))
+		version = row[0].as_int();
+
+	auto have_column = [this](const std::string& table, const std::string& column) {
+		for(auto row : db_->exec("PRAGMA table_info(" + table + ");"))
+			if(row[1].as_text() == column) return true;
+		return false;
+	};
+
+	if(version < 1) {
+		// Version 1: size and chunk count of every entry, used for index statistics
+		SQLiteSavepoint savepoint(*db_, "Index::migrate");
+		if(!have_column("meta", "size")) {
+			LOGD("Migrating index to version 1");
+			db_->exec("ALTER TABLE meta ADD COLUMN size INTEGER DEFAULT (0) NOT NULL;");
+			db_->exec("ALTER TABLE meta ADD COLUMN chunks INTEGER DEFAULT (0) NOT NULL;");
+
+			QList<SignedMeta> smetas;
+			for(auto row : db_->exec("SELECT meta, signature FROM meta;")) {
+				try {
+					smetas << SignedMeta(row[0], row[1], params_.secret);
+				}catch(std::exception& e){}  // Inconsistent entries will be counted as empty
+			}
+			for(auto& smeta : smetas) {
+				db_->prepare("UPDATE meta SET size=?, chunks=? WHERE path_id=?;").exec({
+					(uint64_t)smeta.meta().size(),
+					(uint64_t)smeta.meta().chunks().size(),
+					smeta.meta().path_id()
+				});
+			}
+		}
+		db_->exec("PRAGMA user_version = 1;");
+		savepoint.commit();
+	}
+
+	if(version < 2) {
+		// Version 2: revision of every entry, so revisions are compared without parsing metas
+		SQLiteSavepoint savepoint(*db_, "Index::migrate");
+		if(!have_column("meta", "revision")) {
+			LOGD("Migrating index to version 2");
+			db_->exec("ALTER TABLE meta ADD COLUMN revision INTEGER DEFAULT (0) NOT NULL;");
+
+			QList<SignedMeta> smetas;
+			for(auto row : db_->exec("SELECT meta, signature FROM meta;")) {
+				try {
+					smetas << SignedMeta(row[0], row[1], params_.secret);
+				}catch(std::exception& e){}  // Inconsistent entries keep revision 0, so any remote revision replaces them
+			}
+			for(auto& smeta : smetas) {
+				db_->prepare("UPDATE meta SET revision=? WHERE path_id=?;").exec({
+					(int64_t)smeta.meta().revision(),
+					smeta.meta().path_id()
+				});
+			}
+		}
+		db_->exec("PRAGMA user_version = 2;");
+		savepoint.commit();
+	}
+}
+
+void Index::loadStats() {
+	stats_.clear();
+	for(auto row : db_->exec("SELECT type, COUNT(*), SUM(size), SUM(chunks) FROM meta GROUP BY type;"))
+		stats_[(int)row[0].as_int()] = Stats{row[1].as_int(), row[2].as_int(), row[3].as_int()};
+}
+
+void Index::loadAssembledChunks() {
+	QWriteLocker lk(&assembled_lock_);
+	assembled_chunks_.clear();
+	for(auto row : db_->exec("SELECT ct_hash, COUNT(*) FROM openfs WHERE assembled=1 GROUP BY ct_hash;"))
+		assembled_chunks_[ct_hash_key(row[0].blob_ptr(), row[0].data_size())] += (int)row[1].as_int();
+	for(auto row : db_->exec("SELECT ct_hash, COUNT(*) FROM ondisk GROUP BY ct_hash;"))
+		assembled_chunks_[ct_hash_key(row[0].blob_ptr(), row[0].data_size())] += (int)row[1].as_int();
+}
+
+void Index::applyDelta(const Delta& delta) {
+	for(auto it = delta.stats.begin(); it != delta.stats.end(); it++)
+		stats_[it.key()] += it.value();
+
+	QList<QByteArray> lost_chunks;
+	{
+		QWriteLocker lk(&assembled_lock_);
+		for(auto it = delta.assembled_chunks.begin(); it != delta.assembled_chunks.end(); it++) {
+			int& count = assembled_chunks_[it.key()];
+			count += it.value();
+			if(count <= 0)
+				assembled_chunks_.remove(it.key());
+		}
+
+		// Files, that need these chunks, were told they are present. Now they must be downloaded
+		for(auto& ct_hash : delta.ondisk_removed)
+			if(!assembled_chunks_.contains(ct_hash_key(ct_hash)))
+				lost_chunks.append(conv_bytearray(ct_hash));
+	}
+	if(!lost_chunks.isEmpty())
+		emit onDiskChunksLost(lost_chunks);
+}
+
+QJsonObject Index::collect_state() {
+	QMutexLocker lk(&meta_cache_lock_);
+
+	QJsonObject meta_cache_state;
+	meta_cache_state["hits"] = double(meta_cache_hits_);
+	meta_cache_state["misses"] = double(meta_cache_misses_);
+	meta_cache_state["entries"] = meta_cache_.size();
+
+	QJsonObject state;
+	state["meta_cache"] = meta_cache_state;
+	return state;
 }
 
 void Index::notifyState() {
 	QJsonObject entries;
-	for(auto row : db_->exec("SELECT type, COUNT(*) AS entries FROM meta GROUP BY type")) {
-		entries[QString::number(row[0].as_uint())] = (double)row[1].as_uint();
+	qint64 size = 0, chunks = 0;
+	for(auto it = stats_.begin(); it != stats_.end(); it++) {
+		if(it.value().entries > 0)
+			entries[QString::number(it.key())] = (double)it.value().entries;
+		size += it.value().size;
+		chunks += it.value().chunks;
 	}
-	state_collector_->folder_state_set(conv_bytearray(params_.secret.get_Hash()), "index", entries);
+
+	QByteArray folderid = conv_bytearray(params_.secret.get_Hash());
+	state_collector_->folder_state_set(folderid, "index", entries);
+	state_collector_->folder_state_set(folderid, "index_size", (double)size);
+	state_collector_->folder_state_set(folderid, "index_chunks", (double)chunks);
 }
 
 } /* namespace librevault */
@@ -28,10 +28,18 @@
  */
 #pragma once
 #include "blob.h"
+#include "folder/meta/MetaStorage.h"
 #include "util/log.h"
 #include "util/SQLiteWrapper.h"
 #include <librevault/SignedMeta.h>
+#include <QCache>
+#include <QHash>
+#include <QJsonObject>
+#include <QMap>
+#include <QMutex>
+#include <QReadWriteLock>
 #include <QObject>
+#include <QTimer>
 
 namespace librevault {
 
@@ -44,6 +52,7 @@ class Index : public QObject {
 signals:
 	void metaAdded(SignedMeta meta);
 	void metaAddedExternal(SignedMeta meta);
+	void onDiskChunksLost(QList<QByteArray> ct_hashes);   // Chunks, that were present only in an old layout of a file, which is gone now
 
 public:
 	Index(const FolderParams& params, StateCollector* state_collector, QObject* parent);
@@ -56,15 +65,21 @@ public:
 	QList<SignedMeta> getExistingMeta();
 	QList<SignedMeta> getIncompleteMeta();
 	void putMeta(const SignedMeta& signed_meta, bool fully_assembled = false);
+	void putMeta(const QList<SignedMeta>& signed_metas, bool fully_assembled = false);  // Batch version, puts all metas in one transaction
 
 	bool putAllowed(const Meta::PathRevision& path_revision) noexcept;
+	QHash<QByteArray, qint64> getRevisions(const QList<blob>& path_ids);   // path_id -> revision. Missing paths are omitted
+	QList<MetaStorage::MetaSummary> getMetaSummary(const blob& after_path_id, int limit);
 
 	void setAssembled(blob path_id);
 	bool isAssembledChunk(blob ct_hash);
-	QPair<quint32, QByteArray> getChunkSizeIv(blob ct_hash);
 
 	/* Properties */
 	QList<SignedMeta> containingChunk(const blob& ct_hash);
+	QList<MetaStorage::OnDiskChunk> onDiskChunks(const blob& path_id);
+	QList<MetaStorage::OnDiskChunk> onDiskContainingChunk(const blob& ct_hash);
+
+	QJsonObject collect_state();
 
 private:
 	const FolderParams& params_;
@@ -72,10 +87,65 @@ private:
 
 	std::unique_ptr<SQLiteDB> db_;	// Better use SOCI library ( https://github.com/SOCI/soci ). My "reinvented wheel" isn't stable enough.
 
-	QList<SignedMeta> getMeta(const std::string& sql, const std::map<std::string, SQLValue>& values = std::map<std::string, SQLValue>());
+	/* Statistics. Loaded once on startup and then updated on every put, instead of being aggregated over the whole table */
+	struct Stats {
+		qint64 entries;
+		qint64 size;
+		qint64 chunks;
+
+		Stats& operator+=(const Stats& b) {entries += b.entries; size += b.size; chunks += b.chunks; return *this;}
+		Stats& operator-=(const Stats& b) {entries -= b.entries; size -= b.size; chunks -= b.chunks; return *this;}
+	};
+	QMap<int, Stats> stats_;   // Meta::Type -> Stats
+
+	/* Assembled chunks presence. Makes isAssembledChunk a memory lookup. Loaded once on startup and then updated on every change of openfs and ondisk */
+	mutable QReadWriteLock assembled_lock_;
+	QHash<quint64, int> assembled_chunks_; // ct_hash_key -> number of assembled openfs and ondisk entries
+
+	/* Serializes transactions on db_, together with applying their Delta. setAssembled runs on AssemblerWorker threads,
+	 * and without it, its statements would join a savepoint of the main thread, and in-memory counts would drift from tables */
+	QMutex write_lock_;
+
+	/* Changes of in-memory state, made by a transaction. Applied only after commit */
+	struct Delta {
+		QMap<int, Stats> stats;
+		QHash<quint64, int> assembled_chunks;
+		QList<blob> ondisk_removed;     // ct_hashes of removed ondisk entries
+	};
+	void applyDelta(const Delta& delta);   // Emits onDiskChunksLost
+
+	/* Parsed and verified metas of recently requested paths. Always matches the meta table, as it is invalidated by every put.
+	 * A reader, that started before a put, could fetch the old row, so it is cached only if the generation hasn't changed since. */
+	QMutex meta_cache_lock_;
+	QCache<QByteArray, SignedMeta> meta_cache_;    // path_id -> SignedMeta
+	quint64 meta_cache_generation_ = 0;
+	quint64 meta_cache_hits_ = 0, meta_cache_misses_ = 0;
+
+	/* Queries must return path_id, meta and signature. Full table scans don't populate the cache, they would only flush it */
+	QList<SignedMeta> getMeta(const std::string& sql, const std::map<std::string, SQLValue>& values = std::map<std::string, SQLValue>(), bool populate_cache = false);
+	QList<MetaStorage::OnDiskChunk> getOnDiskChunks(const std::string& sql, const blob& value);
+	void writeMeta(const SignedMeta& signed_meta, bool fully_assembled, Delta& delta);
 	void wipe();
+	void migrate();
 
+	void loadStats();
+	void loadAssembledChunks();
 	void notifyState();
+
+	/* Storage profile */
+	QTimer* checkpoint_timer_ = nullptr;
+	void applyStorageProfile();
+	void applyCacheProfile(SQLiteDB& db);
+	void checkpoint();
+
+	/* Read-only connections, checked out by worker threads. Under WAL they read in parallel with the writer and each other.
+	 * The pool is shared with checked out connections, so a connection, released after Index is destroyed, is just closed */
+	struct ReaderPool {
+		QMutex lock;
+		std::vector<std::unique_ptr<SQLiteDB>> readers;
+	};
+	std::shared_ptr<ReaderPool> reader_pool_ = std::make_shared<ReaderPool>();
+	std::shared_ptr<SQLiteDB> readDB();
 };
 
 } /* namespace librevault */
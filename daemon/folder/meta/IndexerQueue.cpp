@@ -33,6 +33,7 @@
 #include "control/StateCollector.h"
 #include "folder/IgnoreList.h"
 #include "folder/PathNormalizer.h"
+#include <algorithm>
 
 Q_LOGGING_CATEGORY(log_indexer, "folder.meta.indexer")
 
@@ -53,22 +54,35 @@ IndexerQueue::IndexerQueue(const FolderParams& params, IgnoreList* ignore_list,
 	connect(this, &IndexerQueue::finishedIndexing, this, [this]{state_collector_->folder_state_set(conv_bytearray(secret_.get_Hash()), "is_indexing", false);});
 
 	threadpool_ = new QThreadPool(this);
+	chunk_threadpool_ = new QThreadPool(this);
+	chunk_slots_.release(std::max(chunk_threadpool_->maxThreadCount(), 1) * 2);  // Keeps every thread busy, while chunks are collected
+
+	commit_timer_ = new QTimer(this);
+	commit_timer_->setSingleShot(true);
+	commit_timer_->setInterval(params_.index_commit_timeout.count());
+	connect(commit_timer_, &QTimer::timeout, this, &IndexerQueue::commitPending);
 }
 
 IndexerQueue::~IndexerQueue() {
 	qCDebug(log_indexer) << "~IndexerQueue";
 	emit aboutToStop();
 	threadpool_->waitForDone();
+	chunk_threadpool_->waitForDone();
+	commitPending();
 	qCDebug(log_indexer) << "!~IndexerQueue";
 }
 
 void IndexerQueue::addIndexing(QString abspath) {
+	// The worker reads the last revision of this path from the index as its old meta
+	if(pending_paths_.contains(abspath))
+		commitPending();
+
 	if(tasks_.contains(abspath)) {
 		IndexerWorker* worker = tasks_.value(abspath);
 		threadpool_->cancel(worker);
 		worker->stop();
 	}
-	IndexerWorker* worker = new IndexerWorker(abspath, params_, meta_storage_, ignore_list_, path_normalizer_, this);
+	IndexerWorker* worker = new IndexerWorker(abspath, params_, meta_storage_, ignore_list_, path_normalizer_, chunk_threadpool_, &chunk_slots_, this);
 	worker->setAutoDelete(false);
 	connect(this, &IndexerQueue::aboutToStop, worker, &IndexerWorker::stop, Qt::DirectConnection);
 	connect(worker, &IndexerWorker::metaCreated, this, &IndexerQueue::metaCreated);
@@ -84,10 +98,15 @@ void IndexerQueue::metaCreated(SignedMeta smeta) {
 	tasks_.remove(worker->absolutePath());
 	worker->deleteLater();
 
+	pending_metas_ << smeta;
+	pending_paths_ << worker->absolutePath();
+	if(pending_metas_.size() >= (int)params_.index_commit_batch || tasks_.size() == 0)
+		commitPending();
+	else if(!commit_timer_->isActive())
+		commit_timer_->start();
+
 	if(tasks_.size() == 0)
 		emit finishedIndexing();
-
-	meta_storage_->putMeta(smeta, true);
 }
 
 void IndexerQueue::metaFailed(QString error_string) {
@@ -101,4 +120,29 @@ void IndexerQueue::metaFailed(QString error_string) {
 	qCWarning(log_indexer) << "Skipping" << worker->absolutePath() << "Reason:" << error_string;
 }
 
+void IndexerQueue::commitPending() {
+	commit_timer_->stop();
+	if(pending_metas_.isEmpty()) return;
+
+	// A newer revision could come from a remote, while these metas were pending. It must not be overwritten by an older one
+	QList<blob> path_ids;
+	for(auto& smeta : pending_metas_)
+		path_ids << smeta.meta().path_id();
+	QHash<QByteArray, qint64> revisions = meta_storage_->getRevisions(path_ids);
+
+	QList<SignedMeta> allowed_metas;
+	for(auto& smeta : pending_metas_) {
+		auto revision_it = revisions.find(conv_bytearray(smeta.meta().path_id()));
+		if(revision_it == revisions.end() || revision_it.value() < (qint64)smeta.meta().revision())
+			allowed_metas << smeta;
+		else
+			qCDebug(log_indexer) << "Dropping indexed entry, superseded by a newer revision";
+	}
+	pending_metas_.clear();
+	pending_paths_.clear();
+
+	qCDebug(log_indexer) << "Committing" << allowed_metas.size() << "indexed entries";
+	meta_storage_->putMeta(allowed_metas, true);
+}
+
 } /* namespace librevault */
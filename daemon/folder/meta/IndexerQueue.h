@@ -29,8 +29,11 @@
 #pragma once
 #include <librevault/SignedMeta.h>
 #include <QMap>
+#include <QSemaphore>
+#include <QSet>
 #include <QString>
 #include <QThreadPool>
+#include <QTimer>
 
 namespace librevault {
 
@@ -63,14 +66,24 @@ private:
 	StateCollector* state_collector_;
 
 	QThreadPool* threadpool_;
+	QThreadPool* chunk_threadpool_;   // Shared by all IndexerWorkers to process chunks in parallel
+	QSemaphore chunk_slots_;          // Chunks, submitted to chunk_threadpool_ and not yet collected, by all IndexerWorkers
 
 	const Secret& secret_;
 
 	QMap<QString, IndexerWorker*> tasks_;
 
+	/* Write-behind. Created metas are committed to the index in batches. Until then, the index doesn't see them,
+	 * so a path is committed before it is indexed again, and revisions are checked again on commit */
+	QList<SignedMeta> pending_metas_;
+	QSet<QString> pending_paths_;     // abspaths of pending_metas_
+	QTimer* commit_timer_;
+
 private slots:
 	void metaCreated(SignedMeta smeta);
 	void metaFailed(QString error_string);
+
+	void commitPending();
 };
 
 } /* namespace librevault */
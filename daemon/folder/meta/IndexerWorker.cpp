@@ -33,11 +33,13 @@
 #include "folder/IgnoreList.h"
 #include "folder/PathNormalizer.h"
 #include "human_size.h"
+#include "util/FutureRunnable.h"
 #include <librevault/crypto/HMAC-SHA3.h>
 #include <librevault/crypto/AES_CBC.h>
 #include <rabin.h>
 #include <boost/filesystem.hpp>
 #include <QFile>
+#include <deque>
 #ifdef Q_OS_UNIX
 #   include <sys/stat.h>
 #endif
@@ -49,13 +51,15 @@ Q_DECLARE_LOGGING_CATEGORY(log_indexer)
 
 namespace librevault {
 
-IndexerWorker::IndexerWorker(QString abspath, const FolderParams& params, MetaStorage* meta_storage, IgnoreList* ignore_list, PathNormalizer* path_normalizer, QObject* parent) :
+IndexerWorker::IndexerWorker(QString abspath, const FolderParams& params, MetaStorage* meta_storage, IgnoreList* ignore_list, PathNormalizer* path_normalizer, QThreadPool* chunk_threadpool, QSemaphore* chunk_slots, QObject* parent) :
 	QObject(parent),
 	abspath_(abspath),
 	params_(params),
 	meta_storage_(meta_storage),
 	ignore_list_(ignore_list),
 	path_normalizer_(path_normalizer),
+	chunk_threadpool_(chunk_threadpool),
+	chunk_slots_(chunk_slots),
 	secret_(params.secret),
 	active_(true) {}
 
@@ -229,6 +233,34 @@ void IndexerWorker::update_chunks() {
 	// Chunking
 	std::vector<Meta::Chunk> chunks;
 
+	// Chunks are populated (HMAC, encryption and strong hash) on chunk_threadpool_, while this thread keeps searching for cut points.
+	// Futures are collected in file order, so the order of chunks is preserved. Every pending chunk holds one of chunk_slots_,
+	// so all workers of the folder together keep a bounded number of chunks in memory.
+	std::deque<std::future<Meta::Chunk>> pending_chunks;
+
+	secret_.get_Encryption_Key();   // Derive the key here, so it is only read from the worker threads
+
+	auto collect_chunk = [&] {
+		std::future<Meta::Chunk> pending_chunk = std::move(pending_chunks.front());
+		pending_chunks.pop_front();
+		pending_chunk.wait();
+		chunk_slots_->release();
+		chunks.push_back(pending_chunk.get());
+	};
+	auto enqueue_chunk = [&](blob data) {
+		// Free a slot by collecting own chunks. Block only with nothing pending, so slots are held only by workers, that make progress
+		while(!chunk_slots_->tryAcquire()) {
+			if(pending_chunks.empty()) {
+				chunk_slots_->acquire();
+				break;
+			}
+			collect_chunk();
+		}
+		pending_chunks.push_back(run_future<Meta::Chunk>(chunk_threadpool_, [this, data = std::move(data), &pt_hmac__iv] {
+			return populate_chunk(data, pt_hmac__iv);
+		}));
+	};
+
 	blob buffer;
 	buffer.reserve(hasher.maxsize);
 
@@ -236,28 +268,57 @@ void IndexerWorker::update_chunks() {
 	if(!f.open(QIODevice::ReadOnly))
 		throw abort_index("I/O error: " + f.errorString());
 
-	char byte;
-	while(f.getChar(&byte) && active_) {
-		buffer.push_back(byte);
-		//size_t len = fread(buf, 1, sizeof(buf), stdin);
-		uint8_t *ptr = &buffer.back();
-
-		if(rabin_next_chunk(&hasher, ptr, 1) == 1) {    // Found a chunk
-			chunks.push_back(populate_chunk(buffer, pt_hmac__iv));
-			buffer.clear();
+	try {
+		// File is read by large blocks, and the whole block is fed into the rolling hash at once. Cut points do not depend on block size,
+		// because rabin_next_chunk resets its state on every cut, so chunk lists stay the same as with byte-by-byte reading.
+		blob read_buffer(read_block_size);
+		while(active_) {
+			qint64 read_size = f.read(reinterpret_cast<char*>(read_buffer.data()), read_buffer.size());
+			if(read_size < 0)
+				throw abort_index("I/O error: " + f.errorString());
+			if(read_size == 0)
+				break;
+
+			uint8_t* ptr = read_buffer.data();
+			unsigned int left = (unsigned int)read_size;
+			while(left > 0) {
+				int consumed = rabin_next_chunk(&hasher, ptr, left);
+				if(consumed < 0) {  // No cut point in the rest of the block
+					buffer.insert(buffer.end(), ptr, ptr+left);
+					break;
+				}
+
+				// Found a chunk
+				buffer.insert(buffer.end(), ptr, ptr+consumed);
+				enqueue_chunk(std::move(buffer));
+				buffer = blob();
+				buffer.reserve(hasher.maxsize);
+
+				ptr += consumed;
+				left -= consumed;
+			}
 		}
-	}
 
-	if(!active_)
-		throw abort_index("Indexing had been interruped");
+		if(!active_)
+			throw abort_index("Indexing had been interruped");
 
-	if(rabin_finalize(&hasher) != 0)
-		chunks.push_back(populate_chunk(buffer, pt_hmac__iv));
+		if(rabin_finalize(&hasher) != 0)
+			enqueue_chunk(std::move(buffer));
+
+		while(!pending_chunks.empty())
+			collect_chunk();
+	}catch(...){
+		// Jobs reference pt_hmac__iv and this worker, so they must finish before we unwind.
+		for(auto& pending_chunk : pending_chunks)
+			if(pending_chunk.valid()) pending_chunk.wait();
+		chunk_slots_->release(pending_chunks.size());
+		throw;
+	}
 
 	new_meta_.set_chunks(chunks);
 }
 
-Meta::Chunk IndexerWorker::populate_chunk(const blob& data, const std::map<blob, blob>& pt_hmac__iv) {
+Meta::Chunk IndexerWorker::populate_chunk(const blob& data, const std::map<blob, blob>& pt_hmac__iv) const {
 	qCDebug(log_indexer) << "New chunk size:" << data.size();
 	Meta::Chunk chunk;
 	chunk.pt_hmac = data | crypto::HMAC_SHA3_224(secret_.get_Encryption_Key());
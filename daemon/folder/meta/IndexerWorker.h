@@ -32,7 +32,9 @@
 #include <QLoggingCategory>
 #include <QObject>
 #include <QRunnable>
+#include <QSemaphore>
 #include <QString>
+#include <QThreadPool>
 #include <map>
 
 namespace librevault {
@@ -52,7 +54,7 @@ public:
 		abort_index(QString what) : std::runtime_error(what.toStdString()) {}
 	};
 
-	IndexerWorker(QString abspath, const FolderParams& params, MetaStorage* meta_storage, IgnoreList* ignore_list, PathNormalizer* path_normalizer, QObject* parent);
+	IndexerWorker(QString abspath, const FolderParams& params, MetaStorage* meta_storage, IgnoreList* ignore_list, PathNormalizer* path_normalizer, QThreadPool* chunk_threadpool, QSemaphore* chunk_slots, QObject* parent);
 	virtual ~IndexerWorker();
 
 	QString absolutePath() const {return abspath_;}
@@ -67,6 +69,8 @@ private:
 	MetaStorage* meta_storage_;
 	IgnoreList* ignore_list_;
 	PathNormalizer* path_normalizer_;
+	QThreadPool* chunk_threadpool_;
+	QSemaphore* chunk_slots_;   // Shared by all IndexerWorkers, so the number of chunks in memory is bounded for the whole folder
 
 	const Secret& secret_;
 
@@ -79,10 +83,12 @@ private:
 	void make_Meta();
 
 	/* File analyzers */
+	static constexpr size_t read_block_size = 1024*1024;  // Size of a block, read from file at once by the chunker
+
 	Meta::Type get_type();
 	void update_fsattrib();
 	void update_chunks();
-	Meta::Chunk populate_chunk(const blob& data, const std::map<blob, blob>& pt_hmac__iv);
+	Meta::Chunk populate_chunk(const blob& data, const std::map<blob, blob>& pt_hmac__iv) const;   // Thread-safe, called from chunk_threadpool_
 };
 
 } /* namespace librevault */
@@ -51,9 +51,12 @@ MetaStorage::MetaStorage(const FolderParams& params, IgnoreList* ignore_list, Pa
 
 	connect(index_, &Index::metaAdded, this, &MetaStorage::metaAdded);
 	connect(index_, &Index::metaAddedExternal, this, &MetaStorage::metaAddedExternal);
+	connect(index_, &Index::onDiskChunksLost, this, &MetaStorage::onDiskChunksLost);
 };
 
-MetaStorage::~MetaStorage() {}
+MetaStorage::~MetaStorage() {
+	delete indexer_;    // Stops indexing and commits pending metas, while the index is still alive
+}
 
 bool MetaStorage::haveMeta(const Meta::PathRevision& path_revision) noexcept {
 	return index_->haveMeta(path_revision);
@@ -83,10 +86,22 @@ void MetaStorage::putMeta(const SignedMeta& signed_meta, bool fully_assembled) {
 	return index_->putMeta(signed_meta, fully_assembled);
 }
 
+void MetaStorage::putMeta(const QList<SignedMeta>& signed_metas, bool fully_assembled) {
+	return index_->putMeta(signed_metas, fully_assembled);
+}
+
 QList<SignedMeta> MetaStorage::containingChunk(const blob& ct_hash) {
 	return index_->containingChunk(ct_hash);
 }
 
+QList<MetaStorage::OnDiskChunk> MetaStorage::onDiskChunks(const blob& path_id) {
+	return index_->onDiskChunks(path_id);
+}
+
+QList<MetaStorage::OnDiskChunk> MetaStorage::onDiskContainingChunk(const blob& ct_hash) {
+	return index_->onDiskContainingChunk(ct_hash);
+}
+
 void MetaStorage::markAssembled(blob path_id) {
 	index_->setAssembled(path_id);
 }
@@ -95,16 +110,24 @@ bool MetaStorage::isChunkAssembled(blob ct_hash) {
 	return index_->isAssembledChunk(ct_hash);
 }
 
-QPair<quint32, QByteArray> MetaStorage::getChunkSizeIv(blob ct_hash) {
-	return index_->getChunkSizeIv(ct_hash);
-};
-
 bool MetaStorage::putAllowed(const Meta::PathRevision& path_revision) noexcept {
 	return index_->putAllowed(path_revision);
 }
 
+QHash<QByteArray, qint64> MetaStorage::getRevisions(const QList<blob>& path_ids) {
+	return index_->getRevisions(path_ids);
+}
+
+QList<MetaStorage::MetaSummary> MetaStorage::getMetaSummary(const blob& after_path_id, int limit) {
+	return index_->getMetaSummary(after_path_id, limit);
+}
+
 void MetaStorage::prepareAssemble(QByteArray normpath, Meta::Type type, bool with_removal) {
 	watcher_->prepareAssemble(normpath, type, with_removal);
 }
 
+QJsonObject MetaStorage::collect_state() {
+	return index_->collect_state();
+}
+
 } /* namespace librevault */
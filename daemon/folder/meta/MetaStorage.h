@@ -29,6 +29,8 @@
 #pragma once
 #include "blob.h"
 #include <librevault/SignedMeta.h>
+#include <QHash>
+#include <QJsonObject>
 #include <QObject>
 
 namespace librevault {
@@ -47,12 +49,28 @@ class MetaStorage : public QObject {
 signals:
 	void metaAdded(SignedMeta meta);
 	void metaAddedExternal(SignedMeta meta);
+	void onDiskChunksLost(QList<QByteArray> ct_hashes);
 
 public:
 	struct no_such_meta : public std::runtime_error {
 		no_such_meta() : std::runtime_error("Requested Meta not found"){}
 	};
 
+	/* Location of a chunk in a file, that is still on disk, while a newer revision of it waits for assembly */
+	struct OnDiskChunk {
+		blob ct_hash;
+		blob path_id;
+		quint64 offset;
+		quint32 size;
+		blob iv;    // From the chunk table, as the chunk may be missing from the current revision of the file
+	};
+
+	/* What a handshake announces about an entry, read without parsing its meta */
+	struct MetaSummary {
+		Meta::PathRevision revision;
+		std::vector<blob> chunks;   // ct_hashes in file order, empty for non-files
+	};
+
 	MetaStorage(const FolderParams& params, IgnoreList* ignore_list, PathNormalizer* path_normalizer, StateCollector* state_collector, QObject* parent);
 	virtual ~MetaStorage();
 
@@ -63,17 +81,23 @@ public:
 	QList<SignedMeta> getExistingMeta();
 	QList<SignedMeta> getIncompleteMeta();
 	void putMeta(const SignedMeta& signed_meta, bool fully_assembled = false);
+	void putMeta(const QList<SignedMeta>& signed_metas, bool fully_assembled = false);
 	QList<SignedMeta> containingChunk(const blob& ct_hash);
-	QPair<quint32, QByteArray> getChunkSizeIv(blob ct_hash);
+	QList<OnDiskChunk> onDiskChunks(const blob& path_id);
+	QList<OnDiskChunk> onDiskContainingChunk(const blob& ct_hash);
 
 	// Assembled index
 	void markAssembled(blob path_id);
 	bool isChunkAssembled(blob ct_hash);
 
 	bool putAllowed(const Meta::PathRevision& path_revision) noexcept;
+	QHash<QByteArray, qint64> getRevisions(const QList<blob>& path_ids);   // Batch version of haveMeta and putAllowed
+	QList<MetaSummary> getMetaSummary(const blob& after_path_id, int limit);   // Next page of entries, ordered by path_id
 
 	void prepareAssemble(QByteArray normpath, Meta::Type type, bool with_removal = false);
 
+	QJsonObject collect_state();
+
 private:
 	Index* index_;
 	IndexerQueue* indexer_;
@@ -53,11 +53,32 @@ Downloader::Downloader(const FolderParams& params, MetaStorage* meta_storage, QO
 	params_(params),
 	meta_storage_(meta_storage) {
 	LOGFUNC();
+	ChunkFileBuilder::removeStale(params_.system_path);
+
+	reloadConfig();
+	connect(Config::get(), &Config::globalChanged, this, [this](QString key){
+		if(key.startsWith("p2p_")) reloadConfig();
+	});
+
+	int request_timeout = Config::get()->getGlobal("p2p_request_timeout").toInt();
+
 	maintain_timer_ = new QTimer(this);
-	connect(maintain_timer_, &QTimer::timeout, this, &Downloader::maintainRequests);
-	maintain_timer_->setInterval(Config::get()->getGlobal("p2p_request_timeout").toInt()*1000);
+	connect(maintain_timer_, &QTimer::timeout, this, &Downloader::scheduleRequests);
+	maintain_timer_->setInterval(request_timeout*1000);
 	maintain_timer_->setTimerType(Qt::VeryCoarseTimer);
 	maintain_timer_->start();
+
+	schedule_timer_ = new QTimer(this);
+	schedule_timer_->setSingleShot(true);
+	schedule_timer_->setInterval(0);
+	connect(schedule_timer_, &QTimer::timeout, this, &Downloader::maintainRequests);
+
+	timeout_wheel_.resize(std::max(request_timeout, 1) + 1);
+	timeout_timer_ = new QTimer(this);
+	connect(timeout_timer_, &QTimer::timeout, this, &Downloader::expireRequests);
+	timeout_timer_->setInterval(1000);
+	timeout_timer_->setTimerType(Qt::CoarseTimer);
+	timeout_timer_->start();
 }
 
 Downloader::~Downloader() {}
@@ -80,7 +101,8 @@ void Downloader::notifyLocalMeta(const SignedMeta& smeta, const bitfield_type& b
 
 		if(bitfield[chunk_idx]) {
 			have_complete = true;   // We have chunk, remove from missing
-			removeChunk(ct_hash); // Do not mark connected chunks as clustered, because they will be marked inside the loop below.
+			removeChunk(ct_hash); // Do not mark connected chunks as clustered, because they will be marked below.
+			unlinkChunk(ct_hash);
 		}else{
 			have_incomplete = true; // We haven't this chunk, we need to download it
 			addChunk(ct_hash, meta_chunk.size);
@@ -88,14 +110,16 @@ void Downloader::notifyLocalMeta(const SignedMeta& smeta, const bitfield_type& b
 		}
 	}
 
+	linkMeta(conv_bytearray(smeta.meta().path_id()), incomplete_chunks);
+
 	if(have_complete && have_incomplete) {
-		foreach(QByteArray ct_hash, getMetaCluster(incomplete_chunks)) {
-			download_queue_.markClustered(ct_hash);
-		}
+		for(auto& ct_hash : incomplete_chunks)
+			markClusteredChunk(ct_hash);
 	}
 }
 
 void Downloader::addChunk(QByteArray ct_hash, quint32 size) {
+	if(down_chunks_.contains(ct_hash)) return;   // Already downloading, maybe for another file
 	qCDebug(log_downloader) << "Added" << ct_hash_readable(ct_hash) << "to download queue";
 
 	uint32_t padded_size = size % 16 == 0 ? size : ((size / 16) + 1) * 16;
@@ -109,7 +133,7 @@ void Downloader::addChunk(QByteArray ct_hash, quint32 size) {
 void Downloader::removeChunk(QByteArray ct_hash) {
 	if(down_chunks_.contains(ct_hash)) {
 		download_queue_.removeChunk(ct_hash);
-		down_chunks_.remove(ct_hash);
+		dropChunkRequests(*down_chunks_.take(ct_hash));
 
 		qCDebug(log_downloader) << "Removed" << ct_hash_readable(ct_hash) << "from download queue";
 	}
@@ -118,34 +142,62 @@ void Downloader::removeChunk(QByteArray ct_hash) {
 void Downloader::notifyLocalChunk(const blob& ct_hash) {
 	SCOPELOG(log_downloader);
 
-	removeChunk(conv_bytearray(ct_hash));
+	QByteArray ct_hash_q = conv_bytearray(ct_hash);
+	removeChunk(ct_hash_q);
+
+	// Mark all other chunks of its files "clustered"
+	markClusteredChunk(ct_hash_q);
+	unlinkChunk(ct_hash_q);
+}
+
+void Downloader::linkMeta(const QByteArray& path_id, const QList<QByteArray>& missing_chunks) {
+	unlinkMeta(path_id);   // Previous revision
+	if(missing_chunks.isEmpty()) return;
 
-	// Mark all other chunks "clustered"
-	foreach(QByteArray cluster_hash, getCluster(conv_bytearray(ct_hash))) {
-		download_queue_.markClustered(cluster_hash);
+	QSet<QByteArray>& path_chunks = path_missing_chunks_[path_id];
+	for(auto& ct_hash : missing_chunks) {
+		path_chunks.insert(ct_hash);
+		chunk_paths_[ct_hash].insert(path_id);
 	}
 }
 
-QSet<QByteArray> Downloader::getCluster(QByteArray ct_hash) {
-	QSet<QByteArray> cluster;
+void Downloader::unlinkMeta(const QByteArray& path_id) {
+	for(auto& ct_hash : path_missing_chunks_.take(path_id)) {
+		auto paths_it = chunk_paths_.find(ct_hash);
+		if(paths_it == chunk_paths_.end()) continue;
+		paths_it->remove(path_id);
+		if(paths_it->isEmpty())
+			chunk_paths_.erase(paths_it);
+	}
+	clustered_paths_.remove(path_id);
+}
 
-	foreach(const SignedMeta& smeta, meta_storage_->containingChunk(conv_bytearray(ct_hash))) {
-		for(auto& chunk : smeta.meta().chunks()) {
-			cluster << conv_bytearray(chunk.ct_hash);
+void Downloader::unlinkChunk(const QByteArray& ct_hash) {
+	for(auto& path_id : chunk_paths_.take(ct_hash)) {
+		auto chunks_it = path_missing_chunks_.find(path_id);
+		if(chunks_it == path_missing_chunks_.end()) continue;
+		chunks_it->remove(ct_hash);
+		if(chunks_it->isEmpty()) {
+			path_missing_chunks_.erase(chunks_it);
+			clustered_paths_.remove(path_id);
 		}
 	}
-
-	return cluster;
 }
 
-QSet<QByteArray> Downloader::getMetaCluster(QList<QByteArray> ct_hashes) {
-	QSet<QByteArray> cluster;
+void Downloader::markClusteredChunk(const QByteArray& ct_hash) {
+	auto paths_it = chunk_paths_.find(ct_hash);
+	if(paths_it == chunk_paths_.end()) return;
 
-	foreach(QByteArray ct_hash, ct_hashes) {
-		cluster += getCluster(ct_hash);
-	}
+	for(auto& path_id : *paths_it)
+		markClusteredPath(path_id);
+}
+
+void Downloader::markClusteredPath(const QByteArray& path_id) {
+	if(clustered_paths_.contains(path_id)) return;  // Already marked, so every path is walked once
+	clustered_paths_.insert(path_id);
 
-	return cluster;
+	for(auto& ct_hash : path_missing_chunks_.value(path_id))
+		download_queue_.markClustered(ct_hash);
 }
 
 void Downloader::notifyRemoteMeta(RemoteFolder* remote, const Meta::PathRevision& revision, bitfield_type bitfield) {
@@ -173,22 +225,21 @@ void Downloader::notifyRemoteChunk(RemoteFolder* remote, const blob& ct_hash) {
 	chunk->owned_by.insert(remote, remote->get_interest_guard());
 	download_queue_.setRemotesCount(ct_hash_q, chunk->owned_by.size());
 
-	QTimer::singleShot(0, this, &Downloader::maintainRequests);
+	scheduleRequests();
 }
 
 void Downloader::handleChoke(RemoteFolder* remote) {
 	SCOPELOG(log_downloader);
 
 	/* Remove requests to this node */
-	foreach(DownloadChunkPtr missing_chunk, down_chunks_)
-		missing_chunk->requests.remove(remote);
+	dropRemoteRequests(remote);
 
-	QTimer::singleShot(0, this, &Downloader::maintainRequests);
+	scheduleRequests();
 }
 
 void Downloader::handleUnchoke(RemoteFolder* remote) {
 	SCOPELOG(log_downloader);
-	QTimer::singleShot(0, this, &Downloader::maintainRequests);
+	scheduleRequests();
 }
 
 void Downloader::putBlock(const blob& ct_hash, uint32_t offset, const blob& data, RemoteFolder* from) {
@@ -197,6 +248,7 @@ void Downloader::putBlock(const blob& ct_hash, uint32_t offset, const blob& data
 	if(! missing_chunk) return;
 
 	QList<QPair<QByteArray, QFile*>> downloaded_chunks;
+	int matched_requests = 0;
 
 	QMutableHashIterator<RemoteFolder*, DownloadChunk::BlockRequest> request_it(missing_chunk->requests);
 	while(request_it.hasNext()) {
@@ -206,6 +258,8 @@ void Downloader::putBlock(const blob& ct_hash, uint32_t offset, const blob& data
 		&& request_it.value().size == data.size()   // Chunk size incorrect
 		&& request_it.key() == from) {              // Requested node != replied. Well, it isn't critical, but will be useful to ban "fake" peers
 			request_it.remove();
+			dropRequest(missing_chunk->ct_hash, from, data.size());
+			matched_requests++;
 
 			missing_chunk->builder.put_block(offset, QByteArray::fromRawData((const char*)data.data(), data.size()));
 			if(missing_chunk->builder.complete()) {
@@ -217,14 +271,27 @@ void Downloader::putBlock(const blob& ct_hash, uint32_t offset, const blob& data
 		}
 	}
 
+	auto window_it = windows_.find(from);
+	if(window_it != windows_.end() && matched_requests > 0) {
+		window_it->received_bytes += data.size();
+		window_it->failure_rate *= 0.9;
+	}
+
 	for(QPair<QByteArray, QFile*> chunk : downloaded_chunks) {
 		emit chunkDownloaded(chunk.first, chunk.second);
 	}
 
-	QTimer::singleShot(0, this, &Downloader::maintainRequests);
+	scheduleRequests();
 }
 
 void Downloader::trackRemote(RemoteFolder* remote) {
+	PeerWindow window;
+	window.window = window_min_;
+	window.block_size = block_size_;
+	window.block_size_limit = max_block_size_;
+	window.order = next_remote_order_++;
+	windows_.insert(remote, window);
+
 	remotes_.insert(remote);
 	download_queue_.setRemotesCount(remotes_.size());
 }
@@ -234,46 +301,185 @@ void Downloader::untrackRemote(RemoteFolder* remote) {
 
 	if(! remotes_.contains(remote)) return;
 
+	dropRemoteRequests(remote);
 	foreach(DownloadChunkPtr missing_chunk, down_chunks_.values()) {
-		missing_chunk->requests.remove(remote);
-		missing_chunk->owned_by.remove(remote);
-		download_queue_.setRemotesCount(missing_chunk->ct_hash, missing_chunk->owned_by.size());
+		if(missing_chunk->owned_by.remove(remote))
+			download_queue_.setRemotesCount(missing_chunk->ct_hash, missing_chunk->owned_by.size());
 	}
 	remotes_.remove(remote);
+	windows_.remove(remote);
 	download_queue_.setRemotesCount(remotes_.size());
 }
 
+void Downloader::scheduleRequests() {
+	if(!schedule_timer_->isActive())
+		schedule_timer_->start();
+}
+
 void Downloader::maintainRequests() {
 	SCOPELOG(log_downloader);
 
-	// Prune old requests by timeout
-	{
-		auto request_timeout = std::chrono::seconds(Config::get()->getGlobal("p2p_request_timeout").toUInt());
-		foreach(DownloadChunkPtr missing_chunk, down_chunks_.values()) {
-			QMutableHashIterator<RemoteFolder*, DownloadChunk::BlockRequest> request_it(missing_chunk->requests);
-			while(request_it.hasNext()) {
-				if(request_it.next().value().started + request_timeout < std::chrono::steady_clock::now())
-					request_it.remove();
+	// Make new requests, until windows of all remotes are full. Timed out requests are pruned by expireRequests
+	while(requestOne());
+}
+
+void Downloader::addRequest(const DownloadChunkPtr& chunk, RemoteFolder* remote, const DownloadChunk::BlockRequest& request) {
+	chunk->requests.insert(remote, request);
+	remote_requests_[remote][chunk->ct_hash]++;
+
+	auto window_it = windows_.find(remote);
+	if(window_it != windows_.end()) {
+		window_it->outstanding_bytes += request.size;
+		window_it->outstanding_requests++;
+		window_it->busy = true;
+	}
+
+	int request_timeout = timeout_wheel_.size() - 1;
+	timeout_wheel_[(timeout_wheel_pos_ + request_timeout) % timeout_wheel_.size()]
+		.append(RequestDeadline{chunk->ct_hash, remote, request.offset, request.started});
+}
+
+void Downloader::dropRequest(const QByteArray& ct_hash, RemoteFolder* remote, uint32_t size) {
+	auto window_it = windows_.find(remote);
+	if(window_it != windows_.end()) {
+		window_it->outstanding_bytes -= std::min((quint64)size, window_it->outstanding_bytes);
+		window_it->outstanding_requests = std::max(window_it->outstanding_requests - 1, 0);
+	}
+
+	auto remote_it = remote_requests_.find(remote);
+	if(remote_it == remote_requests_.end()) return;
+	auto chunk_it = remote_it->find(ct_hash);
+	if(chunk_it != remote_it->end() && --chunk_it.value() <= 0)
+		remote_it->erase(chunk_it);
+	if(remote_it->isEmpty())
+		remote_requests_.erase(remote_it);
+}
+
+void Downloader::dropRemoteRequests(RemoteFolder* remote) {
+	for(auto& ct_hash : remote_requests_.take(remote).keys()) {
+		auto chunk = down_chunks_.value(ct_hash);
+		if(chunk)
+			chunk->requests.remove(remote);
+	}
+
+	auto window_it = windows_.find(remote);
+	if(window_it != windows_.end()) {
+		window_it->outstanding_bytes = 0;
+		window_it->outstanding_requests = 0;
+	}
+}
+
+void Downloader::dropChunkRequests(DownloadChunk& chunk) {
+	for(auto request_it = chunk.requests.begin(); request_it != chunk.requests.end(); request_it++)
+		dropRequest(chunk.ct_hash, request_it.key(), request_it.value().size);
+	chunk.requests.clear();
+}
+
+void Downloader::expireRequests() {
+	updateWindows();
+
+	timeout_wheel_pos_ = (timeout_wheel_pos_ + 1) % timeout_wheel_.size();
+	QList<RequestDeadline> deadlines;
+	deadlines.swap(timeout_wheel_[timeout_wheel_pos_]);
+
+	bool expired = false;
+	for(auto& deadline : deadlines) {
+		auto chunk = down_chunks_.value(deadline.ct_hash);
+		if(!chunk) continue;
+
+		QMutableHashIterator<RemoteFolder*, DownloadChunk::BlockRequest> request_it(chunk->requests);
+		while(request_it.hasNext()) {
+			request_it.next();
+			if(request_it.key() == deadline.remote
+				&& request_it.value().offset == deadline.offset
+				&& request_it.value().started == deadline.started) {
+				uint32_t size = request_it.value().size;
+				request_it.remove();
+				dropRequest(deadline.ct_hash, deadline.remote, size);
+				expired = true;
+
+				// The remote could be overloaded, or it doesn't serve blocks this large
+				auto window_it = windows_.find(deadline.remote);
+				if(window_it != windows_.end()) {
+					window_it->failure_rate = 0.9*window_it->failure_rate + 0.1;
+					if(size > block_size_)
+						window_it->block_size_limit = std::max(block_size_, std::min(window_it->block_size_limit, size) / 2);
+					window_it->block_size = std::min(window_it->block_size, window_it->block_size_limit);
+					window_it->window = std::max(window_it->window / 2, window_min_);
+				}
+				break;
 			}
 		}
 	}
 
-	// Make new requests
-	{
-		for(size_t i = countRequests(); i < Config::get()->getGlobal("p2p_download_slots").toUInt(); i++) {
-			bool requested = requestOne();
-			if(!requested) break;
+	if(expired)
+		scheduleRequests();
+}
+
+bool Downloader::haveRoom(const PeerWindow& window) const {
+	// p2p_download_slots is only a floor. A window of max-sized blocks needs window/block_size requests to be filled
+	int slots = std::max(download_slots_, int(window.window / std::max(window.block_size, 1u)));
+	if(window.outstanding_requests >= slots)
+		return false;
+	// At least one request is always allowed, even if the block doesn't fit the window
+	return window.outstanding_bytes == 0 || window.outstanding_bytes + window.block_size <= window.window;
+}
+
+void Downloader::updateWindows() {
+	for(auto window_it = windows_.begin(); window_it != windows_.end(); window_it++) {
+		PeerWindow& window = window_it.value();
+
+		// Idle remotes keep their window, there is nothing to measure
+		if(window.busy) {
+			qreal throughput = window.received_bytes / (timeout_timer_->interval() / 1000.0);
+			window.throughput = window.throughput > 0 ? 0.75*window.throughput + 0.25*throughput : throughput;
 		}
+
+		// Until the first pong, RTT is unknown, and the remote keeps its initial window
+		if(window.busy && window_it.key()->rtt().count() > 0) {
+			qreal rtt = window_it.key()->rtt().count() / 1000.0;
+			window.window = qBound(window_min_, quint64(2 * window.throughput * rtt), window_max_);
+
+			// Fit about 8 blocks into a window, so requests to a remote are still pipelined
+			while(window.block_size * 2 <= window.block_size_limit && window.block_size * 2 * 8 <= window.window)
+				window.block_size *= 2;
+			while(window.block_size / 2 >= block_size_ && window.block_size * 8 > window.window)
+				window.block_size /= 2;
+		}
+
+		window.received_bytes = 0;
+		window.busy = window.outstanding_requests > 0;
+	}
+}
+
+void Downloader::reloadConfig() {
+	block_size_ = std::max(Config::get()->getGlobal("p2p_block_size").toUInt(), 1u);
+	max_block_size_ = std::max(block_size_, Config::get()->getGlobal("p2p_max_block_size").toUInt());
+	window_min_ = Config::get()->getGlobal("p2p_window_min").toULongLong();
+	window_max_ = std::max(window_min_, Config::get()->getGlobal("p2p_window_max").toULongLong());
+	download_slots_ = Config::get()->getGlobal("p2p_download_slots").toInt();
+
+	// Existing windows are clamped to the new limits, block sizes are adapted on the next updateWindows()
+	for(auto& window : windows_) {
+		window.block_size_limit = max_block_size_;
+		window.block_size = qBound(block_size_, window.block_size, max_block_size_);
+		window.window = qBound(window_min_, window.window, window_max_);
 	}
 }
 
 bool Downloader::requestOne() {
 	SCOPELOG(log_downloader);
+	// Don't walk the queue, if no remote can take a request anyway
+	bool have_room = false;
+	for(auto window_it = windows_.begin(); window_it != windows_.end() && !have_room; window_it++)
+		have_room = haveRoom(window_it.value()) && window_it.key()->ready() && !window_it.key()->peer_choking();
+	if(!have_room) return false;
+
 	// Try to choose chunk to request
-	foreach(QByteArray ct_hash, download_queue_.chunks()) {
+	return download_queue_.visit([this](const QByteArray& ct_hash) {
 		// Try to choose a remote to request this block from
 		auto remote = nodeForRequest(ct_hash);
-		if(! remote) continue;
+		if(! remote) return false;
 
 		DownloadChunkPtr chunk = down_chunks_.value(ct_hash);
 
@@ -284,15 +490,15 @@ bool Downloader::requestOne() {
 		if(!request_map.full()) {
 			DownloadChunk::BlockRequest request;
 			request.offset = request_map.begin()->first;
-			request.size = std::min(request_map.begin()->second, uint32_t(Config::get()->getGlobal("p2p_block_size").toUInt()));
+			request.size = std::min(request_map.begin()->second, windows_.value(remote).block_size);
 			request.started = std::chrono::steady_clock::now();
 
 			remote->request_block(conv_bytearray(ct_hash), request.offset, request.size);
-			chunk->requests.insert(remote, request);
+			addRequest(chunk, remote, request);
 			return true;
 		}
-	}
-	return false;
+		return false;
+	});
 }
 
 RemoteFolder* Downloader::nodeForRequest(QByteArray ct_hash) {
@@ -300,17 +506,35 @@ RemoteFolder* Downloader::nodeForRequest(QByteArray ct_hash) {
 	if(! chunk)
 		return nullptr;
 
-	foreach(RemoteFolder* owner_remote, chunk->owned_by.keys())
-		if(owner_remote->ready() && !owner_remote->peer_choking()) return owner_remote; // TODO: implement more smart peer selection algorithm, based on peer weights.
+	RemoteFolder* best_remote = nullptr;
+	qreal best_delay = 0;
+	quint64 best_order = 0;
+	for(auto owner_it = chunk->owned_by.constBegin(); owner_it != chunk->owned_by.constEnd(); owner_it++) {
+		RemoteFolder* owner_remote = owner_it.key();
+		if(!owner_remote->ready() || owner_remote->peer_choking()) continue;
+
+		auto window_it = windows_.constFind(owner_remote);
+		if(window_it == windows_.constEnd() || !haveRoom(window_it.value())) continue;
+
+		qreal delay = expectedDelay(owner_remote, window_it.value());
+		if(!best_remote || delay < best_delay || (delay == best_delay && window_it->order < best_order)) {
+			best_remote = owner_remote;
+			best_delay = delay;
+			best_order = window_it->order;
+		}
+	}
 
-	return nullptr;
+	return best_remote;
 }
 
-size_t Downloader::countRequests() const {
-	size_t requests = 0;
-	foreach(DownloadChunkPtr chunk, down_chunks_.values())
-		requests += chunk->requests.size();
-	return requests;
+qreal Downloader::expectedDelay(RemoteFolder* remote, const PeerWindow& window) const {
+	const qreal default_rtt = 0.1;  // Until the first pong, assume a typical WAN RTT, so the remote is not taken for the closest one
+	qreal rtt = remote->rtt().count() > 0 ? remote->rtt().count() / 1000.0 : default_rtt;
+	// Until measured, throughput is assumed to fill the window in one RTT, so new remotes get their share of requests
+	qreal throughput = window.throughput > 0 ? window.throughput : window.window / rtt;
+
+	qreal delay = rtt + (window.outstanding_bytes + window.block_size) / throughput;
+	return delay * (1 + 4 * window.failure_rate);
 }
 
 } /* namespace librevault */
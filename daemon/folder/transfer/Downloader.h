@@ -33,17 +33,13 @@
 #include "util/AvailabilityMap.h"
 #include "blob.h"
 #include "util/log.h"
+#include <QHash>
 #include <QList>
+#include <QSet>
 #include <QTimer>
-#include <boost/bimap.hpp>
-#include <boost/bimap/multiset_of.hpp>
-#include <boost/bimap/unordered_set_of.hpp>
+#include <QVector>
 #include <chrono>
 
-#define CLUSTERED_COEFFICIENT 10.0f
-#define IMMEDIATE_COEFFICIENT 20.0f
-#define RARITY_COEFFICIENT 25.0f
-
 namespace librevault {
 
 class FolderParams;
@@ -102,11 +98,72 @@ private:
 	QHash<QByteArray, DownloadChunkPtr> down_chunks_;
 	WeightedChunkQueue download_queue_;
 
-	size_t countRequests() const;
+	/* Outstanding requests per remote. Kept in sync with DownloadChunk::requests by addRequest and dropRequest* */
+	QHash<RemoteFolder*, QHash<QByteArray, int>> remote_requests_;   // remote -> ct_hash -> number of requests
+
+	void addRequest(const DownloadChunkPtr& chunk, RemoteFolder* remote, const DownloadChunk::BlockRequest& request);
+	void dropRequest(const QByteArray& ct_hash, RemoteFolder* remote, uint32_t size);   // After removal of one request from DownloadChunk::requests
+	void dropRemoteRequests(RemoteFolder* remote);
+	void dropChunkRequests(DownloadChunk& chunk);
+
+	/* Request pipelining. Every remote gets a window of bytes in flight, that follows its bandwidth-delay product:
+	 * 2 * throughput * RTT. While the window limits the download, throughput follows it, so the window keeps growing,
+	 * until the link does. Block size follows the window, and is cut on every timeout, because the remote could refuse it.
+	 * Number of requests in flight is limited by p2p_download_slots, or by window/block_size, if it is larger.
+	 * So p2p_window_max (64 MiB) can be filled with p2p_max_block_size (1 MiB) blocks, which 10 slots alone couldn't do */
+	struct PeerWindow {
+		quint64 window = 0;
+		quint64 outstanding_bytes = 0;
+		int outstanding_requests = 0;
+
+		uint32_t block_size = 0;
+		uint32_t block_size_limit = 0;
+
+		quint64 received_bytes = 0; // Since last updateWindows()
+		bool busy = false;          // Had requests in flight since last updateWindows()
+		qreal throughput = 0;       // Bytes per second, moving average
+
+		qreal failure_rate = 0;     // Share of timed out requests, moving average
+		quint64 order = 0;          // Order of tracking, breaks ties between equal remotes
+	};
+	QHash<RemoteFolder*, PeerWindow> windows_;
+	quint64 next_remote_order_ = 0;
+
+	bool haveRoom(const PeerWindow& window) const;
+	void updateWindows();
+
+	/* Globals, used on every request. Cached, and reloaded on Config::globalChanged */
+	uint32_t block_size_ = 0;
+	uint32_t max_block_size_ = 0;
+	quint64 window_min_ = 0;
+	quint64 window_max_ = 0;
+	int download_slots_ = 0;
+
+	void reloadConfig();
+
+	/* Peer selection. A block goes to the remote, that is expected to deliver it first: after its RTT and after the bytes,
+	 * already queued to it, at its throughput. Remotes, that time out, are penalized by their failure rate */
+	qreal expectedDelay(RemoteFolder* remote, const PeerWindow& window) const;
+
+	/* Request timeouts. Wheel of 1-second slots, a request is put into the slot, that is reached after the timeout.
+	 * Requests, that were answered before, are skipped on expiration. Windows are updated on the same tick */
+	struct RequestDeadline {
+		QByteArray ct_hash;
+		RemoteFolder* remote;
+		uint32_t offset;
+		std::chrono::steady_clock::time_point started;
+	};
+	QVector<QList<RequestDeadline>> timeout_wheel_;
+	int timeout_wheel_pos_ = 0;
+	QTimer* timeout_timer_;
+
+	void expireRequests();
 
-	/* Request process */
+	/* Request process. Events only schedule a pass, so a burst of them is handled with one pass */
 	QTimer* maintain_timer_;
+	QTimer* schedule_timer_;
 
+	void scheduleRequests();
 	void maintainRequests();
 	bool requestOne();
 	RemoteFolder* nodeForRequest(QByteArray ct_hash);
@@ -117,8 +174,18 @@ private:
 	/* Node management */
 	QSet<RemoteFolder*> remotes_;
 
-	QSet<QByteArray> getCluster(QByteArray ct_hash);
-	QSet<QByteArray> getMetaCluster(QList<QByteArray> ct_hashes);
+	/* Clusters. Chunks of a file, that is partially present locally, are "clustered" and downloaded first.
+	 * Missing chunks and files, containing them, are linked both ways. So, when a chunk arrives, its files are found without
+	 * index queries, and every file marks its missing chunks only once. */
+	QHash<QByteArray, QSet<QByteArray>> path_missing_chunks_;  // path_id -> ct_hashes
+	QHash<QByteArray, QSet<QByteArray>> chunk_paths_;          // ct_hash -> path_ids
+	QSet<QByteArray> clustered_paths_;
+
+	void linkMeta(const QByteArray& path_id, const QList<QByteArray>& missing_chunks);
+	void unlinkMeta(const QByteArray& path_id);
+	void unlinkChunk(const QByteArray& ct_hash);
+	void markClusteredChunk(const QByteArray& ct_hash);
+	void markClusteredPath(const QByteArray& path_id);
 };
 
 } /* namespace librevault */
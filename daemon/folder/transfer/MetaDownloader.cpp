@@ -39,15 +39,40 @@ MetaDownloader::MetaDownloader(MetaStorage* meta_storage, Downloader* downloader
 	meta_storage_(meta_storage),
 	downloader_(downloader) {
 	LOGFUNC();
+
+	have_meta_timer_ = new QTimer(this);
+	have_meta_timer_->setSingleShot(true);
+	have_meta_timer_->setInterval(0);
+	connect(have_meta_timer_, &QTimer::timeout, this, &MetaDownloader::process_have_meta);
 }
 
 void MetaDownloader::handle_have_meta(RemoteFolder* origin, const Meta::PathRevision& revision, const bitfield_type& bitfield) {
-	if(meta_storage_->haveMeta(revision))
-		downloader_->notifyRemoteMeta(origin, revision, bitfield);
-	else if(meta_storage_->putAllowed(revision))
-		origin->request_meta(revision);
-	else
-		LOGD("Remote node notified us about an expired Meta");
+	pending_have_meta_.append(PendingHaveMeta{origin, revision, bitfield});
+	if(!have_meta_timer_->isActive())
+		have_meta_timer_->start();
+}
+
+void MetaDownloader::process_have_meta() {
+	QList<PendingHaveMeta> pending;
+	pending.swap(pending_have_meta_);
+
+	QList<blob> path_ids;
+	path_ids.reserve(pending.size());
+	for(auto& have_meta : pending)
+		path_ids.append(have_meta.revision.path_id_);
+	auto revisions = meta_storage_->getRevisions(path_ids);
+
+	for(auto& have_meta : pending) {
+		if(!have_meta.origin) continue;    // Disconnected meanwhile
+
+		auto revision_it = revisions.find(conv_bytearray(have_meta.revision.path_id_));
+		if(revision_it != revisions.end() && revision_it.value() == (qint64)have_meta.revision.revision_)
+			downloader_->notifyRemoteMeta(have_meta.origin, have_meta.revision, have_meta.bitfield);
+		else if(revision_it == revisions.end() || revision_it.value() < (qint64)have_meta.revision.revision_)
+			have_meta.origin->request_meta(have_meta.revision);
+		else
+			LOGD("Remote node notified us about an expired Meta");
+	}
 }
 
 void MetaDownloader::handle_meta_reply(RemoteFolder* origin, const SignedMeta& smeta, const bitfield_type& bitfield) {
@@ -31,6 +31,8 @@
 #include <librevault/SignedMeta.h>
 #include <librevault/util/conv_bitfield.h>
 #include <QObject>
+#include <QPointer>
+#include <QTimer>
 
 namespace librevault {
 
@@ -51,6 +53,17 @@ public:
 private:
 	MetaStorage* meta_storage_;
 	Downloader* downloader_;
+
+	/* A handshake brings one HAVE_META per file. They are collected during one event loop iteration and checked with one revision lookup */
+	struct PendingHaveMeta {
+		QPointer<RemoteFolder> origin;
+		Meta::PathRevision revision;
+		bitfield_type bitfield;
+	};
+	QList<PendingHaveMeta> pending_have_meta_;
+	QTimer* have_meta_timer_;
+
+	void process_have_meta();
 };
 
 } /* namespace librevault */
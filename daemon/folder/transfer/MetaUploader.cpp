@@ -37,6 +37,10 @@ MetaUploader::MetaUploader(MetaStorage* meta_storage, ChunkStorage* chunk_storag
 	QObject(parent),
 	meta_storage_(meta_storage), chunk_storage_(chunk_storage) {
 	LOGFUNC();
+
+	handshake_timer_ = new QTimer(this);
+	handshake_timer_->setInterval(0);
+	connect(handshake_timer_, &QTimer::timeout, this, &MetaUploader::continue_handshakes);
 }
 
 void MetaUploader::broadcast_meta(QList<RemoteFolder*> remotes, const Meta::PathRevision& revision, const bitfield_type& bitfield) {
@@ -46,9 +50,47 @@ void MetaUploader::broadcast_meta(QList<RemoteFolder*> remotes, const Meta::Path
 }
 
 void MetaUploader::handle_handshake(RemoteFolder* remote) {
-	for(auto& meta : meta_storage_->getMeta()) {
-		remote->post_have_meta(meta.meta().path_revision(), chunk_storage_->make_bitfield(meta.meta()));
+	handshakes_.append(HandshakeCursor{remote, blob()});
+	connect(remote, &RemoteFolder::bytesWritten, this, &MetaUploader::resume_handshakes, Qt::UniqueConnection);
+	resume_handshakes();
+}
+
+void MetaUploader::resume_handshakes() {
+	if(!handshakes_.isEmpty() && !handshake_timer_->isActive())
+		handshake_timer_->start();
+}
+
+void MetaUploader::continue_handshakes() {
+	const int page_size = 256;
+	const qint64 max_pending_bytes = 256*1024;
+
+	bool sent_any = false;
+	for(auto it = handshakes_.begin(); it != handshakes_.end();) {
+		if(!it->remote) {   // Disconnected before the whole index was announced
+			it = handshakes_.erase(it);
+			continue;
+		}
+
+		if(it->remote->pendingBytes() >= max_pending_bytes) {  // Wait, until the socket drains
+			it++;
+			continue;
+		}
+		sent_any = true;
+
+		auto summaries = meta_storage_->getMetaSummary(it->after_path_id, page_size);
+		for(auto& summary : summaries)
+			it->remote->post_have_meta(summary.revision, chunk_storage_->make_bitfield(summary.chunks));
+
+		if(summaries.size() < page_size) {
+			it = handshakes_.erase(it);
+		}else{
+			it->after_path_id = summaries.last().revision.path_id_;
+			it++;
+		}
 	}
+
+	if(handshakes_.isEmpty() || !sent_any)
+		handshake_timer_->stop();
 }
 
 void MetaUploader::handle_meta_request(RemoteFolder* remote, const Meta::PathRevision& revision) {
@@ -31,6 +31,8 @@
 #include <librevault/Meta.h>
 #include <librevault/util/conv_bitfield.h>
 #include <QObject>
+#include <QPointer>
+#include <QTimer>
 #include <set>
 
 namespace librevault {
@@ -54,6 +56,20 @@ public:
 private:
 	MetaStorage* meta_storage_;
 	ChunkStorage* chunk_storage_;
+
+	/* Handshake announcements are streamed page by page, ordered by path_id, one page per remote on every timer tick.
+	 * So the event loop keeps running and socket keeps draining, while a large folder is announced.
+	 * A page is sent only while the remote's send buffer is below a threshold. If every remote is over it,
+	 * the timer stops and is resumed, when some of the buffered data is written. */
+	struct HandshakeCursor {
+		QPointer<RemoteFolder> remote;
+		blob after_path_id;
+	};
+	QList<HandshakeCursor> handshakes_;
+	QTimer* handshake_timer_;
+
+	void continue_handshakes();
+	void resume_handshakes();
 };
 
 } /* namespace librevault */
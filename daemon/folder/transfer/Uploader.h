@@ -53,8 +53,6 @@ public:
 
 private:
 	ChunkStorage* chunk_storage_;
-
-	blob get_block(const blob& ct_hash, uint32_t offset, uint32_t size);
 };
 
 } /* namespace librevault */
@@ -27,7 +27,8 @@
  * files in the program, then also delete it here.
  */
 #include "ChunkFileBuilder.h"
-#include <librevault/crypto/Base32.h>
+#include "util/sharded_path.h"
+#include <QDir>
 #include <QLoggingCategory>
 
 namespace librevault {
@@ -50,7 +51,8 @@ QFile* ChunkFileBuilderFdPool::getFile(QString path, bool release) {
 
 /* ChunkFileBuilder */
 ChunkFileBuilder::ChunkFileBuilder(QString system_path, QByteArray ct_hash, quint32 size) : file_map_(size) {
-	chunk_location_ = system_path + "/incomplete-" + conv_bytearray(ct_hash | crypto::Base32());
+	chunk_location_ = make_sharded_path(system_path + "/incomplete", "incomplete-", ct_hash);
+	QDir().mkpath(QFileInfo(chunk_location_).path());
 
 	QFile f(chunk_location_);
 	f.open(QIODevice::WriteOnly | QIODevice::Truncate);
@@ -62,6 +64,13 @@ ChunkFileBuilder::~ChunkFileBuilder() {
 		QFile::remove(chunk_location_);
 }
 
+void ChunkFileBuilder::removeStale(QString system_path) {
+	// Incomplete chunks can't be resumed, as their availability maps are kept in memory only
+	for(const QString& name : QDir(system_path).entryList({"incomplete-*"}, QDir::Files))
+		QFile::remove(system_path + "/" + name);    // Flat layout of earlier versions
+	QDir(system_path + "/incomplete").removeRecursively();
+}
+
 QFile* ChunkFileBuilder::release_chunk() {
 	QFile* f = ChunkFileBuilderFdPool::get_instance()->getFile(chunk_location_, true);
 	chunk_location_.clear();
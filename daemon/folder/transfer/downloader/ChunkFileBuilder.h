@@ -56,6 +56,8 @@ public:
 	ChunkFileBuilder(QString system_path, QByteArray ct_hash, quint32 size);
 	~ChunkFileBuilder();
 
+	static void removeStale(QString system_path);    // Removes incomplete chunks, left from the previous run
+
 	QFile* release_chunk();
 	void put_block(quint32 offset, const QByteArray& content);
 
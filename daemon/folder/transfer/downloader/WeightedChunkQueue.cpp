@@ -27,86 +27,78 @@
  * files in the program, then also delete it here.
  */
 #include "WeightedChunkQueue.h"
-#include <QLoggingCategory>
-#include <boost/range/adaptor/map.hpp>
 
 namespace librevault {
 
-float WeightedChunkQueue::Weight::value() const {
+float WeightedChunkQueue::weight(int chunk_class, int owned_by) const {
 	float weight_value = 0;
 
-	weight_value += CLUSTERED_COEFFICIENT * (clustered ? 1 : 0);
-	weight_value += IMMEDIATE_COEFFICIENT * (immediate ? 1 : 0);
-	float rarity = (float)(remotes_count - owned_by) / (float)remotes_count;
-	weight_value += rarity * RARITY_COEFFICIENT;
+	weight_value += CLUSTERED_COEFFICIENT * ((chunk_class & CLUSTERED) ? 1 : 0);
+	weight_value += IMMEDIATE_COEFFICIENT * ((chunk_class & IMMEDIATE) ? 1 : 0);
+	if(remotes_count_ > 0) {
+		float rarity = (float)(remotes_count_ - owned_by) / (float)remotes_count_;
+		weight_value += rarity * RARITY_COEFFICIENT;
+	}
 
 	return weight_value;
 }
 
-WeightedChunkQueue::Weight WeightedChunkQueue::getCurrentWeight(QByteArray chunk) {
-	auto it = weight_ordered_chunks_.left.find(chunk);
-	if(it != weight_ordered_chunks_.left.end())
-		return it->second;
-	else
-		return Weight();
+void WeightedChunkQueue::place(const QByteArray& chunk, Entry& entry) {
+	Bucket& bucket = classes_[entry.chunk_class][entry.owned_by];
+	entry.position = bucket.insert(bucket.end(), chunk);
 }
 
-void WeightedChunkQueue::reweightChunk(QByteArray chunk, Weight new_weight) {
-	auto chunk_it = weight_ordered_chunks_.left.find(chunk);
+void WeightedChunkQueue::unplace(Entry& entry) {
+	auto bucket_it = classes_[entry.chunk_class].find(entry.owned_by);
+	bucket_it->second.erase(entry.position);
+	if(bucket_it->second.empty())
+		classes_[entry.chunk_class].erase(bucket_it);
+}
 
-	if(chunk_it != weight_ordered_chunks_.left.end() && chunk_it->second != new_weight) {
-		weight_ordered_chunks_.left.erase(chunk_it);
-		weight_ordered_chunks_.left.insert(queue_left_value(chunk, new_weight));
-	}
+void WeightedChunkQueue::reweightChunk(const QByteArray& chunk, int chunk_class, int owned_by) {
+	auto entry_it = entries_.find(chunk);
+	if(entry_it == entries_.end()) return;
+	if(entry_it->chunk_class == chunk_class && entry_it->owned_by == owned_by) return;
+
+	unplace(*entry_it);
+	entry_it->chunk_class = chunk_class;
+	entry_it->owned_by = owned_by;
+	place(chunk, *entry_it);
 }
 
 void WeightedChunkQueue::addChunk(QByteArray chunk) {
-	weight_ordered_chunks_.left.insert(queue_left_value(chunk, Weight()));
+	if(entries_.contains(chunk)) return;
+	place(chunk, entries_[chunk]);
 }
 
 void WeightedChunkQueue::removeChunk(QByteArray chunk) {
-	weight_ordered_chunks_.left.erase(chunk);
+	auto entry_it = entries_.find(chunk);
+	if(entry_it == entries_.end()) return;
+
+	unplace(*entry_it);
+	entries_.erase(entry_it);
 }
 
 void WeightedChunkQueue::setRemotesCount(int count) {
-	weight_ordered_chunks_t new_queue;
-	for(auto& entry : weight_ordered_chunks_.left) {
-		QByteArray chunk = entry.first;
-		Weight weight = entry.second;
-
-		weight.remotes_count = count;
-		new_queue.left.insert(queue_left_value(chunk, weight));
-	}
-	weight_ordered_chunks_ = new_queue;
+	remotes_count_ = count;
 }
 
 void WeightedChunkQueue::setRemotesCount(QByteArray chunk, int count) {
-	Weight weight = getCurrentWeight(chunk);
-	weight.owned_by = count;
-
-	reweightChunk(chunk, weight);
+	auto entry_it = entries_.constFind(chunk);
+	if(entry_it != entries_.constEnd())
+		reweightChunk(chunk, entry_it->chunk_class, count);
 }
 
 void WeightedChunkQueue::markClustered(QByteArray chunk) {
-	Weight weight = getCurrentWeight(chunk);
-	weight.clustered = true;
-
-	reweightChunk(chunk, weight);
+	auto entry_it = entries_.constFind(chunk);
+	if(entry_it != entries_.constEnd())
+		reweightChunk(chunk, entry_it->chunk_class | CLUSTERED, entry_it->owned_by);
 }
 
 void WeightedChunkQueue::markImmediate(QByteArray chunk) {
-	Weight weight = getCurrentWeight(chunk);
-	weight.immediate = true;
-
-	reweightChunk(chunk, weight);
-}
-
-QList<QByteArray> WeightedChunkQueue::chunks() const {
-	QList<QByteArray> chunk_list;
-	chunk_list.reserve(weight_ordered_chunks_.size());
-	for(auto& chunk_ptr : boost::adaptors::values(weight_ordered_chunks_.right))
-		chunk_list << chunk_ptr;
-	return chunk_list;
+	auto entry_it = entries_.constFind(chunk);
+	if(entry_it != entries_.constEnd())
+		reweightChunk(chunk, entry_it->chunk_class | IMMEDIATE, entry_it->owned_by);
 }
 
 } /* namespace librevault */
@@ -27,49 +27,24 @@
  * files in the program, then also delete it here.
  */
 #pragma once
-#include <QList>
-#include <boost/bimap.hpp>
-#include <boost/bimap/multiset_of.hpp>
-#include <boost/bimap/unordered_set_of.hpp>
+#include <QByteArray>
+#include <QHash>
+#include <list>
+#include <map>
 
 #define CLUSTERED_COEFFICIENT 10.0f
 #define IMMEDIATE_COEFFICIENT 20.0f
 #define RARITY_COEFFICIENT 25.0f
 
-inline std::size_t hash_value(const QByteArray& val) {
-	return qHash(val);
-}
-
 namespace librevault {
 
-class FolderParams;
-class MetaStorage;
-class ChunkStorage;
-
+/* Download queue, ordered by weight = clustered + immediate + rarity.
+ *
+ * Rarity depends on the global remote count, so it is not stored per chunk. Instead, chunks are split into 4 classes
+ * by their (clustered, immediate) flags, and inside a class they are bucketed by owned_by. Fewer owners means higher
+ * weight for any remote count, so every class is already ordered, and visit() merges classes lazily, computing weights
+ * only for their heads. So a remote count change costs O(1) and a reweight costs O(log b), b = number of distinct owner counts. */
 class WeightedChunkQueue {
-	struct Weight {
-		bool clustered = false;
-		bool immediate = false;
-
-		int owned_by = 0;
-		int remotes_count = 0;
-
-		float value() const;
-		bool operator<(const Weight& b) const {return value() > b.value();}
-		bool operator==(const Weight& b) const {return value() == b.value();}
-		bool operator!=(const Weight& b) const {return !(*this == b);}
-	};
-	using weight_ordered_chunks_t = boost::bimap<
-		boost::bimaps::unordered_set_of<QByteArray>,
-		boost::bimaps::multiset_of<Weight>
-	>;
-	using queue_left_value = weight_ordered_chunks_t::left_value_type;
-	using queue_right_value = weight_ordered_chunks_t::right_value_type;
-	weight_ordered_chunks_t weight_ordered_chunks_;
-
-	Weight getCurrentWeight(QByteArray chunk);
-	void reweightChunk(QByteArray chunk, Weight new_weight);
-
 public:
 	void addChunk(QByteArray chunk);
 	void removeChunk(QByteArray chunk);
@@ -80,7 +55,66 @@ public:
 	void markClustered(QByteArray chunk);
 	void markImmediate(QByteArray chunk);
 
-	QList<QByteArray> chunks() const;
+	int size() const {return entries_.size();}
+
+	/* Calls visitor(chunk) for chunks from heaviest to lightest, until it returns true. Returns, whether it was stopped.
+	 * Chunks, owned by no remote, can't be requested, so they are skipped, though they are the "rarest" */
+	template <class Visitor>
+	bool visit(Visitor visitor) const;
+
+private:
+	enum ChunkClass {CLUSTERED = 1, IMMEDIATE = 2, CLASS_COUNT = 4};
+
+	using Bucket = std::list<QByteArray>;   // In order of insertion
+	using ClassBuckets = std::map<int, Bucket>;    // owned_by -> Bucket
+
+	struct Entry {
+		int chunk_class = 0;
+		int owned_by = 0;
+		Bucket::iterator position;
+	};
+	QHash<QByteArray, Entry> entries_;
+	ClassBuckets classes_[CLASS_COUNT];
+	int remotes_count_ = 0;
+
+	float weight(int chunk_class, int owned_by) const;
+	void place(const QByteArray& chunk, Entry& entry);
+	void unplace(Entry& entry);
+	void reweightChunk(const QByteArray& chunk, int chunk_class, int owned_by);
 };
 
+template <class Visitor>
+bool WeightedChunkQueue::visit(Visitor visitor) const {
+	struct Head {
+		ClassBuckets::const_iterator bucket;
+		Bucket::const_iterator chunk;
+	} heads[CLASS_COUNT];
+
+	for(int chunk_class = 0; chunk_class < CLASS_COUNT; chunk_class++) {
+		heads[chunk_class].bucket = classes_[chunk_class].upper_bound(0);
+		if(heads[chunk_class].bucket != classes_[chunk_class].end())
+			heads[chunk_class].chunk = heads[chunk_class].bucket->second.begin();
+	}
+
+	forever {
+		int best_class = -1;
+		float best_weight = 0;
+		for(int chunk_class = 0; chunk_class < CLASS_COUNT; chunk_class++) {
+			if(heads[chunk_class].bucket == classes_[chunk_class].end()) continue;
+			float class_weight = weight(chunk_class, heads[chunk_class].bucket->first);
+			if(best_class == -1 || class_weight > best_weight) {
+				best_class = chunk_class;
+				best_weight = class_weight;
+			}
+		}
+		if(best_class == -1) return false;
+
+		Head& head = heads[best_class];
+		if(visitor(*head.chunk)) return true;
+
+		if(++head.chunk == head.bucket->second.end() && ++head.bucket != classes_[best_class].end())
+			head.chunk = head.bucket->second.begin();
+	}
+}
+
 } /* namespace librevault */
@@ -37,6 +37,7 @@
 #include "util/conv_bitarray.h"
 #include <librevault/Tokens.h>
 #include <librevault/protocol/V1Parser.h>
+#include <algorithm>
 
 namespace librevault {
 
@@ -60,6 +61,10 @@ P2PFolder::P2PFolder(QWebSocket* socket, FolderGroup* fgroup, P2PProvider* provi
 	connect(ping_timer_, &QTimer::timeout, this, [this]{socket_->ping();});
 	connect(timeout_timer_, &QTimer::timeout, this, &P2PFolder::deleteLater);
 	connect(socket_, &QWebSocket::pong, this, &P2PFolder::handlePong);
+	connect(socket_, &QWebSocket::bytesWritten, this, [this](qint64 bytes){
+		pending_bytes_ = std::max(pending_bytes_ - bytes, qint64(0));   // Control frames (ping) are written, but not counted
+		emit bytesWritten();
+	});
 	connect(socket_, &QWebSocket::binaryMessageReceived, this, &P2PFolder::handle_message);
 	connect(socket_, &QWebSocket::connected, this, &P2PFolder::handleConnected);
 	connect(socket_, &QWebSocket::aboutToClose, this, [=]{fgroup_->detach(this);});
@@ -139,7 +144,7 @@ blob P2PFolder::remote_token() {
 void P2PFolder::send_message(const blob& message) {
 	counter_.add_up(message.size());
 	fgroup_->bandwidth_counter().add_up(message.size());
-	socket_->sendBinaryMessage(QByteArray::fromRawData((char*)message.data(), message.size()));
+	pending_bytes_ += socket_->sendBinaryMessage(QByteArray::fromRawData((char*)message.data(), message.size()));
 }
 
 void P2PFolder::sendHandshake() {
@@ -249,15 +254,17 @@ void P2PFolder::request_block(const blob& ct_hash, uint32_t offset, uint32_t len
 		<< " offset=" << offset
 		<< " length=" << length);
 }
-void P2PFolder::post_block(const blob& ct_hash, uint32_t offset, const blob& block) {
+void P2PFolder::post_block(const blob& ct_hash, uint32_t offset, blob block) {
+	size_t block_size = block.size();
+
 	V1Parser::BlockReply message;
 	message.ct_hash = ct_hash;
 	message.offset = offset;
-	message.content = block;
+	message.content = std::move(block);
 	send_message(V1Parser().gen_BlockReply(message));
 
-	counter_.add_up_blocks(block.size());
-	fgroup_->bandwidth_counter().add_up_blocks(block.size());
+	counter_.add_up_blocks(block_size);
+	fgroup_->bandwidth_counter().add_up_blocks(block_size);
 
 	LOGD("==> BLOCK_REPLY:"
 		<< " ct_hash=" << ct_hash_readable(ct_hash)
@@ -321,6 +328,7 @@ void P2PFolder::handle_Handshake(const blob& message_raw) {
 
 		LOGD("LV Handshake successful");
 		handshake_received_ = true;
+		socket_->ping();    // Measure RTT now, instead of on the first ping timer tick
 
 		emit handshakeSuccess();
 	}catch(std::exception& e){
@@ -461,7 +469,7 @@ void P2PFolder::bump_timeout() {
 
 void P2PFolder::handlePong(quint64 rtt) {
 	bump_timeout();
-	rtt_ = std::chrono::milliseconds(rtt);
+	rtt_ = std::chrono::milliseconds(std::max(rtt, quint64(1)));   // 0 means "not measured yet"
 }
 
 void P2PFolder::handleConnected() {
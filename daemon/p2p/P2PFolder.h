@@ -72,6 +72,8 @@ public:
 	// Handshake
 	void sendHandshake();
 	bool ready() const {return handshake_sent_ && handshake_received_;}
+	std::chrono::milliseconds rtt() const {return rtt_;}
+	qint64 pendingBytes() const {return pending_bytes_;}
 
 	/* Message senders */
 	void choke();
@@ -87,7 +89,7 @@ public:
 	void cancel_meta(const Meta::PathRevision& revision);
 
 	void request_block(const blob& ct_hash, uint32_t offset, uint32_t size);
-	void post_block(const blob& ct_hash, uint32_t offset, const blob& block);
+	void post_block(const blob& ct_hash, uint32_t offset, blob block);
 	void cancel_block(const blob& ct_hash, uint32_t offset, uint32_t size);
 
 private:
@@ -121,7 +123,8 @@ private:
 
 	void bump_timeout();
 
-	std::chrono::milliseconds rtt_ = std::chrono::milliseconds(0);
+	std::chrono::milliseconds rtt_ = std::chrono::milliseconds(0);   // 0 until the first pong
+	qint64 pending_bytes_ = 0;
 
 	/* Message handlers */
 	void handle_message(const QByteArray& message);
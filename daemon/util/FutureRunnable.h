@@ -0,0 +1,75 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#pragma once
+#include <QRunnable>
+#include <QThreadPool>
+#include <functional>
+#include <future>
+
+namespace librevault {
+
+namespace detail {
+template <class Result>
+void fulfill_promise(std::promise<Result>& promise, std::function<Result()>& func) {promise.set_value(func());}
+inline void fulfill_promise(std::promise<void>& promise, std::function<void()>& func) {func(); promise.set_value();}
+} /* namespace detail */
+
+/* FutureRunnable runs a function on a QThreadPool and delivers its result (or exception) through std::future */
+template <class Result>
+class FutureRunnable : public QRunnable {
+public:
+	explicit FutureRunnable(std::function<Result()> func) : func_(std::move(func)) {
+		setAutoDelete(true);
+	}
+
+	std::future<Result> get_future() {return promise_.get_future();}
+
+	void run() override {
+		try {
+			detail::fulfill_promise(promise_, func_);
+		}catch(...){
+			promise_.set_exception(std::current_exception());
+		}
+	}
+
+private:
+	std::function<Result()> func_;
+	std::promise<Result> promise_;
+};
+
+/* Starts func on the pool. The future must be waited for before anything, referenced by func, is destroyed */
+template <class Result>
+std::future<Result> run_future(QThreadPool* pool, std::function<Result()> func) {
+	auto runnable = new FutureRunnable<Result>(std::move(func));
+	auto future = runnable->get_future();
+	pool->start(runnable);
+	return future;
+}
+
+} /* namespace librevault */
@@ -24,6 +24,26 @@ SQLValue::SQLValue(const char* text_ptr, uint64_t text_size) : value_type(ValueT
 SQLValue::SQLValue(const std::vector<uint8_t>& blob_val) : value_type(ValueType::BLOB), blob_val(blob_val.data()), size(blob_val.size()){}
 SQLValue::SQLValue(const uint8_t* blob_ptr, uint64_t blob_size) : value_type(ValueType::BLOB), blob_val(blob_ptr), size(blob_size) {}
 
+static void bind_value(sqlite3_stmt* stmt, int idx, const SQLValue& value) {
+	switch(value.get_type()){
+	case SQLValue::ValueType::INT:
+		sqlite3_bind_int64(stmt, idx, value.as_int());
+		break;
+	case SQLValue::ValueType::DOUBLE:
+		sqlite3_bind_double(stmt, idx, value.as_double());
+		break;
+	case SQLValue::ValueType::TEXT:
+		sqlite3_bind_text64(stmt, idx, value.text_ptr(), value.data_size(), SQLITE_TRANSIENT, SQLITE_UTF8);
+		break;
+	case SQLValue::ValueType::BLOB:
+		sqlite3_bind_blob64(stmt, idx, value.blob_ptr(), value.data_size(), SQLITE_TRANSIENT);
+		break;
+	case SQLValue::ValueType::NULL_VALUE:
+		sqlite3_bind_null(stmt, idx);
+		break;
+	}
+}
+
 // SQLiteResultIterator
 SQLiteResultIterator::SQLiteResultIterator(sqlite3_stmt* prepared_stmt,
 		std::shared_ptr<int64_t> shared_idx,
@@ -105,7 +125,7 @@ SQLValue SQLiteResultIterator::operator[](size_t pos) const {
 }
 
 // SQLiteResult
-SQLiteResult::SQLiteResult(sqlite3_stmt* prepared_stmt) : prepared_stmt(prepared_stmt) {
+SQLiteResult::SQLiteResult(sqlite3_stmt* prepared_stmt, bool reuse_stmt) : prepared_stmt(prepared_stmt), reuse_stmt(reuse_stmt) {
 	rescode = sqlite3_step(prepared_stmt);
 	shared_idx = std::make_shared<int64_t>();
 	*shared_idx = 0;
@@ -126,7 +146,13 @@ SQLiteResult::~SQLiteResult(){
 }
 
 void SQLiteResult::finalize(){
-	sqlite3_finalize(prepared_stmt);
+	if(reuse_stmt) {
+		if(prepared_stmt) {
+			sqlite3_reset(prepared_stmt);
+			sqlite3_clear_bindings(prepared_stmt);
+		}
+	}else
+		sqlite3_finalize(prepared_stmt);
 	prepared_stmt = 0;
 }
 
@@ -139,27 +165,28 @@ SQLiteResultIterator SQLiteResult::end() {
 }
 
 // SQLiteDB
-SQLiteDB::SQLiteDB(const boost::filesystem::path& db_path) {
-	open(db_path);
+SQLiteDB::SQLiteDB(const boost::filesystem::path& db_path, int flags) {
+	open(db_path, flags);
 }
 
-SQLiteDB::SQLiteDB(const char* db_path) {
-	open(db_path);
+SQLiteDB::SQLiteDB(const char* db_path, int flags) {
+	open(db_path, flags);
 }
 
 SQLiteDB::~SQLiteDB() {
 	close();
 }
 
-void SQLiteDB::open(const boost::filesystem::path& db_path) {
-	open(db_path.string().c_str());
+void SQLiteDB::open(const boost::filesystem::path& db_path, int flags) {
+	open(db_path.string().c_str(), flags);
 }
 
-void SQLiteDB::open(const char* db_path) {
-	sqlite3_open(db_path, &db);
+void SQLiteDB::open(const char* db_path, int flags) {
+	sqlite3_open_v2(db_path, &db, flags, 0);
 }
 
 void SQLiteDB::close() {
+	statements.clear();
 	sqlite3_close(db);
 }
 
@@ -167,39 +194,39 @@ SQLiteResult SQLiteDB::exec(const std::string& sql, const std::map<std::string,
 	sqlite3_stmt* sqlite_stmt;
 	sqlite3_prepare_v2(db, sql.c_str(), (int)sql.size()+1, &sqlite_stmt, 0);
 
-	for(auto value : values){
-		switch(value.second.get_type()){
-		case SQLValue::ValueType::INT:
-			sqlite3_bind_int64(sqlite_stmt, sqlite3_bind_parameter_index(sqlite_stmt, value.first.c_str()), value.second.as_int());
-			break;
-		case SQLValue::ValueType::DOUBLE:
-			sqlite3_bind_double(sqlite_stmt, sqlite3_bind_parameter_index(sqlite_stmt, value.first.c_str()), value.second.as_double());
-			break;
-		case SQLValue::ValueType::TEXT: {
-			auto text_data = value.second.as_text();
-			sqlite3_bind_text64(sqlite_stmt, sqlite3_bind_parameter_index(sqlite_stmt, value.first.c_str()),
-					text_data.data(), text_data.size(),
-					SQLITE_TRANSIENT, SQLITE_UTF8);
-		} break;
-		case SQLValue::ValueType::BLOB: {
-			auto blob_data = value.second.as_blob();
-			sqlite3_bind_blob64(sqlite_stmt, sqlite3_bind_parameter_index(sqlite_stmt, value.first.c_str()),
-					blob_data.data(), blob_data.size(),
-					SQLITE_TRANSIENT);
-		} break;
-		case SQLValue::ValueType::NULL_VALUE:
-			sqlite3_bind_null(sqlite_stmt, sqlite3_bind_parameter_index(sqlite_stmt, value.first.c_str()));
-			break;
-		}
-	}
+	for(auto value : values)
+		bind_value(sqlite_stmt, sqlite3_bind_parameter_index(sqlite_stmt, value.first.c_str()), value.second);
 
 	return SQLiteResult(sqlite_stmt);
 }
 
+SQLiteStatement& SQLiteDB::prepare(const std::string& sql) {
+	auto& statement = statements[sql];
+	if(!statement)
+		statement = std::make_unique<SQLiteStatement>(*this, sql);
+	return *statement;
+}
+
 int64_t SQLiteDB::last_insert_rowid(){
 	return sqlite3_last_insert_rowid(db);
 }
 
+// SQLiteStatement
+SQLiteStatement::SQLiteStatement(SQLiteDB& db, const std::string& sql) {
+	sqlite3_prepare_v2(db.sqlite3_handle(), sql.c_str(), (int)sql.size()+1, &prepared_stmt, 0);
+}
+
+SQLiteStatement::~SQLiteStatement() {
+	sqlite3_finalize(prepared_stmt);
+}
+
+SQLiteResult SQLiteStatement::exec(const std::vector<SQLValue>& values) {
+	for(size_t i = 0; i < values.size(); i++)
+		bind_value(prepared_stmt, (int)i+1, values[i]);
+
+	return SQLiteResult(prepared_stmt, true);
+}
+
 SQLiteSavepoint::SQLiteSavepoint(SQLiteDB& db, const std::string savepoint_name) : db(db), name(savepoint_name) {
 	db.exec(std::string("SAVEPOINT ")+name);
 }
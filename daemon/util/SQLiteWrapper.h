@@ -52,7 +52,7 @@ public:
 	SQLValue(const uint8_t* blob_ptr, uint64_t blob_size);	// Binds BLOB value;
 	template<uint64_t array_size> SQLValue(std::array<uint8_t, array_size> blob_array) : SQLValue(blob_array.data(), blob_array.size()){}
 
-	ValueType get_type(){return value_type;};
+	ValueType get_type() const {return value_type;};
 
 	bool is_null() const {return value_type == ValueType::NULL_VALUE;};
 	int64_t as_int() const {return int_val;}
@@ -60,6 +60,9 @@ public:
 	double as_double() const {return double_val;}
 	std::string as_text() const {return std::string(text_val, text_val+size);}
 	std::vector<uint8_t> as_blob() const {return std::vector<uint8_t>(blob_val, blob_val+size);}
+	const char* text_ptr() const {return text_val;}
+	const uint8_t* blob_ptr() const {return blob_val;}
+	uint64_t data_size() const {return size;}
 	template<uint64_t array_size> std::array<uint8_t, array_size> as_blob() const {
 		std::array<uint8_t, array_size> new_array; std::copy(blob_val, blob_val+std::min(size, array_size), new_array.data());
 		return new_array;
@@ -106,10 +109,11 @@ class SQLiteResult {
 	int rescode = SQLITE_OK;
 
 	sqlite3_stmt* prepared_stmt = 0;
+	bool reuse_stmt = false;	// Statement is owned by SQLiteStatement, so it is reset instead of being finalized
 	std::shared_ptr<int64_t> shared_idx;
 	std::shared_ptr<std::vector<std::string>> cols;
 public:
-	SQLiteResult(sqlite3_stmt* prepared_stmt);
+	SQLiteResult(sqlite3_stmt* prepared_stmt, bool reuse_stmt = false);
 	virtual ~SQLiteResult();
 
 	void finalize();
@@ -122,24 +126,41 @@ public:
 	std::vector<std::string> column_names(){return *cols;};
 };
 
+class SQLiteDB;
+
+/* SQLiteStatement is a statement, which is prepared once and then reused with different (positional) parameters.
+ * Only one SQLiteResult of a statement may be alive at once. */
+class SQLiteStatement {
+public:
+	SQLiteStatement(SQLiteDB& db, const std::string& sql);
+	~SQLiteStatement();
+
+	SQLiteResult exec(const std::vector<SQLValue>& values = std::vector<SQLValue>());
+
+private:
+	sqlite3_stmt* prepared_stmt = 0;
+};
+
 class SQLiteDB {
 public:
 	SQLiteDB(){};
-	SQLiteDB(const boost::filesystem::path& db_path);
-	SQLiteDB(const char* db_path);
+	SQLiteDB(const boost::filesystem::path& db_path, int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+	SQLiteDB(const char* db_path, int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
 	virtual ~SQLiteDB();
 
-	void open(const boost::filesystem::path& db_path);
-	void open(const char* db_path);
+	void open(const boost::filesystem::path& db_path, int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+	void open(const char* db_path, int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
 	void close();
 
 	sqlite3* sqlite3_handle(){return db;};
 
 	SQLiteResult exec(const std::string& sql, const std::map<std::string, SQLValue>& values = std::map<std::string, SQLValue>());
+	SQLiteStatement& prepare(const std::string& sql);	// Returns a cached prepared statement
 
 	int64_t last_insert_rowid();
 private:
 	sqlite3* db = 0;
+	std::map<std::string, std::unique_ptr<SQLiteStatement>> statements;
 };
 
 class SQLiteSavepoint {
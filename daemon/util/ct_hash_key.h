@@ -0,0 +1,54 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#pragma once
+#include "blob.h"
+#include <QByteArray>
+#include <QtGlobal>
+#include <algorithm>
+#include <cstring>
+
+namespace librevault {
+
+/* Compact key of a ct_hash for in-memory indexes. ct_hash is a strong hash, so its leading 64 bits are uniformly distributed,
+ * and two different chunks of a folder practically never get the same key. */
+inline quint64 ct_hash_key(const uint8_t* ct_hash, size_t size) {
+	quint64 key = 0;
+	std::memcpy(&key, ct_hash, std::min(size, sizeof(key)));
+	return key;
+}
+
+inline quint64 ct_hash_key(const blob& ct_hash) {
+	return ct_hash_key(ct_hash.data(), ct_hash.size());
+}
+
+inline quint64 ct_hash_key(const QByteArray& ct_hash) {
+	return ct_hash_key(reinterpret_cast<const uint8_t*>(ct_hash.constData()), ct_hash.size());
+}
+
+} /* namespace librevault */
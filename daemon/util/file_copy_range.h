@@ -0,0 +1,97 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#pragma once
+#include "file_pread.h"
+#include <QFileDevice>
+#include <QtGlobal>
+#include <algorithm>
+#include <vector>
+#ifdef Q_OS_LINUX
+#	include <cerrno>
+#	include <linux/fs.h>
+#	include <sys/ioctl.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif
+
+namespace librevault {
+
+/* Copies size bytes from src at src_offset to dst at dst_offset, and leaves dst positioned right after the copied range.
+ * On Linux it tries to share extents with FICLONERANGE (when the range is block-aligned), then copy_file_range, which lets
+ * the filesystem reflink or copy the data in kernel. Elsewhere, or if both fail, data is copied with positional reads and writes. */
+inline bool file_copy_range(QFile& src, qint64 src_offset, QFileDevice& dst, qint64 dst_offset, qint64 size) {
+	if(!dst.flush())
+		return false;
+
+	qint64 done = 0;
+#ifdef Q_OS_LINUX
+	const qint64 block_size = 4096;
+#	ifdef FICLONERANGE
+	if(src_offset % block_size == 0 && dst_offset % block_size == 0 && size % block_size == 0) {
+		struct file_clone_range clone_range = {};
+		clone_range.src_fd = src.handle();
+		clone_range.src_offset = (quint64)src_offset;
+		clone_range.src_length = (quint64)size;
+		clone_range.dest_offset = (quint64)dst_offset;
+		if(ioctl(dst.handle(), FICLONERANGE, &clone_range) == 0)
+			done = size;
+	}
+#	endif
+#	ifdef SYS_copy_file_range
+	while(done < size) {
+		loff_t off_in = src_offset + done, off_out = dst_offset + done;
+		long copied = syscall(SYS_copy_file_range, src.handle(), &off_in, dst.handle(), &off_out, size_t(size - done), 0u);
+		if(copied < 0 && errno == EINTR)
+			continue;
+		if(copied <= 0)
+			break;  // Not supported here, fall back to read/write
+		done += copied;
+	}
+#	endif
+#endif
+
+	if(done < size) {
+		std::vector<char> buffer(std::min<qint64>(size - done, 1024*1024));
+		if(!dst.seek(dst_offset + done))
+			return false;
+		while(done < size) {
+			qint64 portion = std::min<qint64>(size - done, buffer.size());
+			if(file_pread(src, buffer.data(), portion, src_offset + done) != portion)
+				return false;
+			if(dst.write(buffer.data(), portion) != portion)
+				return false;
+			done += portion;
+		}
+		return dst.flush();
+	}
+
+	return dst.seek(dst_offset + size);
+}
+
+} /* namespace librevault */
@@ -0,0 +1,68 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#pragma once
+#include <QFile>
+#include <QtGlobal>
+#ifdef Q_OS_WIN
+#	include <io.h>
+#	include <windows.h>
+#else
+#	include <cerrno>
+#	include <unistd.h>
+#endif
+
+namespace librevault {
+
+/* Positional read from an opened file. Does not move the file position, so it can be called concurrently on the same QFile */
+inline qint64 file_pread(QFile& f, char* data, qint64 size, qint64 offset) {
+	qint64 done = 0;
+	while(done < size) {
+#ifdef Q_OS_WIN
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = DWORD((offset + done) & 0xFFFFFFFF);
+		overlapped.OffsetHigh = DWORD((offset + done) >> 32);
+		DWORD read_now = 0;
+		if(!ReadFile((HANDLE)_get_osfhandle(f.handle()), data + done, DWORD(size - done), &read_now, &overlapped))
+			return -1;
+#else
+		ssize_t read_now = ::pread(f.handle(), data + done, size_t(size - done), off_t(offset + done));
+		if(read_now < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+#endif
+		if(read_now == 0)
+			break;
+		done += read_now;
+	}
+	return done;
+}
+
+} /* namespace librevault */
@@ -0,0 +1,43 @@
+/* Copyright (C) 2016 Alexander Shishenko <alex@shishenko.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+#pragma once
+#include <librevault/crypto/Base32.h>
+#include <QByteArray>
+#include <QString>
+
+namespace librevault {
+
+/* Chunk files are spread over a two-level fan-out by the first two characters of their Base32 name:
+ * <root>/<c0>/<c1>/<prefix><base32>. That's 1024 leaf directories, so none of them grows large enough to slow down lookups. */
+inline QString make_sharded_path(const QString& root, const QString& prefix, const QByteArray& ct_hash) {
+	QString encoded = QString::fromStdString(crypto::Base32().to_string(ct_hash));
+	return root + "/" + encoded.mid(0, 1) + "/" + encoded.mid(1, 1) + "/" + prefix + encoded;
+}
+
+} /* namespace librevault */
@@ -63,7 +63,8 @@ QVariant FolderModel::data(const QModelIndex &index, int role) const {
 			case Column::SIZE: {
 				QJsonObject index = daemon_->state()->getFolderValue(folderid, "index").toObject();
 				return tr("%n file(s)", "", index["0"].toInt())
-					+ " " + tr("%n directory(s)", "", index["1"].toInt());
+					+ " " + tr("%n directory(s)", "", index["1"].toInt())
+					+ " (" + human_size((uintmax_t)daemon_->state()->getFolderValue(folderid, "index_size").toDouble()) + ")";
 			}
 
 			default: return QVariant();